@@ -8,7 +8,10 @@
   * Date				: November 27, 2021
   ******************************************************************************
   */
+#ifndef INC_ADC_H_
+#define INC_ADC_H_
 
+#include "adc_spi.h"
 
 #define ADC_DEFAULT_RESOLUTION		24
 #define ADC_DEFAULT_MAX_RAW			0xFFFFFF
@@ -20,5 +23,112 @@
 #define HV_VOLTAGE_CH				2
 #define ADC_MAX_RANGE				2.4
 
-double *getADCConvertedData();
+//fixed-point pipeline: converted values are integers in micro-units (uA, uV)
+//obtained as (raw code * scale) >> ADC_SCALE_SHIFT with one 64-bit scale per channel
+#define ADC_FIXED_SCALE				1000000
+#define ADC_SCALE_SHIFT				32
+#define ADC_FIXED_TO_DOUBLE(x)		((double)(x) / ADC_FIXED_SCALE)
+
+#define ADC_GAIN_QTY				8		//PGA settings, gain = 2^index
+
+//engineering units per code for a channel divider and PGA setting, evaluated at compile time
+#define ADC_UNITS_PER_CODE(divider, log2Gain)	(ADC_MAX_RANGE / ((double)(1 << (log2Gain)) * ADC_DEFAULT_MAX_RAW * (divider)))
+#define ADC_SCALE_Q_RAW(divider, log2Gain)		(ADC_UNITS_PER_CODE(divider, log2Gain) * ADC_FIXED_SCALE * (double)(1ULL << ADC_SCALE_SHIFT))
+#define ADC_SCALE_Q(divider, log2Gain)			((int64_t)(ADC_SCALE_Q_RAW(divider, log2Gain) + (ADC_SCALE_Q_RAW(divider, log2Gain) >= 0 ? 0.5 : -0.5)))
+
+//big-endian 24-bit code to int32: one unaligned load, byte reverse and arithmetic shift, no branches.
+//Reads the byte following the code, always inside the frame.
+#define ADC_UNPACK24(p)		((int32_t)__REV(__UNALIGNED_UINT32_READ(p)) >> 8)
+
+//channel code of a frame in a layout (ADCgetLayout), in 24-bit code units whatever the
+//word length so the scale tables apply unchanged. Disabled channels read 0
+#define ADC_FRAME_CODE(frame, layout, ch)	\
+	((int32_t)(__REV(__UNALIGNED_UINT32_READ(&(frame)[(layout)->channelOffset[ch]])) & (layout)->codeMask[ch]) >> (layout)->codeShift)
+
+//channel code of a word aligned frame in 32-bit sign-extended words (layout->signExtended),
+//one aligned load and one byte reverse, no shift
+#define ADC_FRAME_CODE32(frame, layout, ch)	\
+	((int32_t)(__REV(((const uint32_t *)(const void *)(frame))[(ch) + 1]) & (layout)->codeMask[ch]))
+
+double *getADCConvertedData(uint8_t *frame);
 double getADCSingleChannel(uint8_t channel);
+int32_t *getADCConvertedFixed(uint8_t *frame);
+int32_t *getADCConvertedFixedLayout(const uint8_t *frame, const ADCframeLayoutTypedef *layout);
+int32_t getADCSingleChannelFixed(uint8_t channel);
+int32_t ADCcodeFromFixed(uint8_t channel, int32_t value);
+int32_t ADCcodeFromFixedGain(uint8_t channel, int32_t value, uint8_t log2Gain);
+int64_t ADCgetScale(uint8_t channel, uint8_t log2Gain);
+int32_t *getADCConvertedFixedTagged(uint8_t *frame, uint16_t gainTag);
+uint16_t getADCConvertedGainTag(void);
+const int32_t *getADCConvertedCodes(void);
+void ADCupdateScaleFactors(uint8_t *log2Gain);
+int32_t convert24bitTo32bit(uint8_t *byteArray);
+void ADCunpackFrames(const uint8_t *frames, uint32_t stride, uint16_t count, int32_t *const channels[3]);
+
+//auto-ranging PGA: the gain is lowered as soon as a code goes above ADC_RANGE_HIGH and
+//raised when the peak of a whole window stays below ADC_RANGE_LOW, which is less than
+//half of ADC_RANGE_HIGH so the doubled signal does not step the gain back down
+#define ADC_RANGE_FULL_SCALE		0x7FFFFF
+#define ADC_RANGE_HIGH				(ADC_RANGE_FULL_SCALE / 100 * 80)
+#define ADC_RANGE_LOW				(ADC_RANGE_FULL_SCALE / 100 * 35)
+#define ADC_RANGE_WINDOW			64		//frames evaluated before raising a gain
+#define ADC_RANGE_CHANNELS			0x07	//channels ranged automatically, one bit per channel, calibrated ones excepted
+
+void ADCautoRange(const uint8_t *frame, uint16_t gainTag);
+void ADCautoRangeEnable(bool enable);
+bool ADCautoRangeEnabled(void);
+
+//on-chip calibration, stored in the parameters area of the EEPROM identification page
+#define ADC_CAL_SIGNATURE			0x4C414333		//"CAL3", PGA gains of the calibration added
+#define ADC_CAL_FRAMES				64				//frames averaged per calibration point
+#define ADC_CAL_SETTLE_FRAMES		4				//frames discarded after a register write
+#define ADC_CAL_TIMEOUT				100				//extra time allowed to collect the frames, in ms
+
+//STATUS flags that make the data of a frame suspect: configuration lost or conversions
+//restarted. Channels enabled without their DRDY flag are counted as well
+#define ADC_STATUS_SAMPLE_FAULTS	(STATUS_RESET | STATUS_F_RESYNC)
+
+//ADC health decoded from the STATUS word of every frame, counted since power up
+typedef struct {
+	uint32_t statusFrames;		//frames with a STATUS word
+	uint32_t responseFrames;	//frames carrying a command response instead
+	uint32_t resets;			//STATUS RESET
+	uint32_t regmapChanges;		//STATUS REG_MAP
+	uint32_t inputCrcErrors;	//STATUS CRC_ERR
+	uint32_t resyncs;			//STATUS F_RESYNC
+	uint32_t drdyMissing;		//an enabled channel without its DRDY flag
+} ADChealthTypedef;
+
+typedef struct {
+	uint32_t signature;
+	int32_t offset[3];			//CHx_OCAL, in codes
+	uint32_t gain[3];			//CHx_GCAL, GCAL_DEFAULT is 1.0
+	int16_t phase[3];			//CHx_CFG PHASE, in modulator clocks
+	uint8_t log2Gain[3];		//PGA gain the offset and gain were measured at, kept while calibrated
+	uint16_t crc;				//ADC CRC of the fields above
+} ADCcalibrationTypedef;
+
+bool ADCdecodeStatus(const uint8_t *frame, bool response);
+const ADChealthTypedef *ADCgetHealth(void);
+uint8_t ADCloadCalibration(void);
+uint8_t ADCsaveCalibration(void);
+uint8_t ADCresetCalibration(void);
+uint8_t ADCcalibrateOffset(uint8_t channel);
+uint8_t ADCcalibrateGain(uint8_t channel, int32_t reference);
+const ADCcalibrationTypedef *ADCgetCalibration(void);
+
+//phase alignment measurement: a step of the HV current is captured and the delay of
+//the voltage edge is taken from the centroids of the first differences of both channels
+#define ADC_PHASE_FRAMES			64		//frames kept around the step, power of two
+#define ADC_PHASE_PRETRIGGER		(ADC_PHASE_FRAMES / 2)
+#define ADC_PHASE_STEP_MIN			(ADC_RANGE_FULL_SCALE / 20)	//current change that triggers, in codes
+#define ADC_PHASE_STEP_SPAN			4		//frames over which the current change is measured
+#define ADC_PHASE_EDGE_MIN			1000	//smallest voltage edge accepted, in codes
+#define ADC_PHASE_WINDOW			8		//frames each side of the edge used for the centroids
+#define ADC_PHASE_TIMEOUT			10000	//time allowed for the step, in ms
+#define ADC_PHASE_FRAC_BITS			8		//centroid resolution, 1/256 frame
+
+uint8_t ADCsetPhase(uint8_t channel, int16_t phase);
+uint8_t ADCmeasurePhase(int32_t *delay);
+
+#endif /* INC_ADC_H_ */
@@ -15,10 +15,92 @@
 #include "main.h"
 #include <stdio.h>
 #include "spi.h"
+#include "stdbool.h"
 
-#define ADC_WORD_SIZE	24
 #define ADC_TIMEOUT		100
 
+//frame layout: the word length follows MODE WLENGTH (16, 24 or 32 bits) and the frame
+//is cut after the last channel enabled in CLOCK. Disabled channels before it keep
+//their word. Only frames reaching CH2 carry the CRC word
+#define ADC_FRAME_WORDS		5		//STATUS + 3 channels + CRC
+#define ADC_FRAME_MIN_WORDS	3		//a WREG in a captured frame needs command, data and CRC words
+#define ADC_WORD_MAX_BYTES	4
+#define ADC_FRAME_SIZE		(ADC_WORD_MAX_BYTES * ADC_FRAME_WORDS)	//frame buffers, any layout
+#define ADC_CHANNEL_MASK_ALL	0x07
+//word length set by ADCinit: 16, 24 or 32. In 32-bit mode the words are sign-extended,
+//with word aligned frame buffers the codes are read as whole int32 words
+#define ADC_DEFAULT_WORD_BITS	24
+#if ADC_DEFAULT_WORD_BITS != 16 && ADC_DEFAULT_WORD_BITS != 24 && ADC_DEFAULT_WORD_BITS != 32
+#error "ADC_DEFAULT_WORD_BITS must be 16, 24 or 32"
+#endif
+
+//when set, the DRDY interrupt starts a DMA read of the frame into the sample
+//queue and the main loop only consumes completed frames
+#define ADC_CAPTURE_DMA		1
+
+//CHx_OCAL/GCAL registers, 24-bit values split in MSB (bits 23:8) and LSB (bits 7:0 in bits 15:8) registers
+#define ADC_CH_REG_STRIDE	(CH1_CFG - CH0_CFG)
+#define OCAL_DEFAULT		0
+#define GCAL_DEFAULT		0x800000	//gain of 1.0, GCAL is unsigned 1.23
+#define GCAL_MAX			0xFFFFFF
+
+//CHx_CFG register: PHASE (bits 15:6) delays the channel by whole modulator clock
+//periods (1/fMOD, fMOD = CLKIN / 2), two's complement. DCBLK_DIS and MUX are kept at 0
+#define CFG_PHASE_SHIFT		6
+#define CFG_PHASE_MASK		0x3FF
+#define ADC_PHASE_MIN		(-512)
+#define ADC_PHASE_MAX		511
+
+//CFG register current detect: while CD_EN is set DRDY only goes low once CD_NUM of
+//CD_LEN conversions exceed the THRSHLD magnitude on an enabled channel (on all of them
+//with CD_ALLCH). 24-bit data words, register contents in bits 23:8
+#define CFG_DEFAULT			0x060000	//GC_DLY 16, global chop and current detect off
+#define CFG_CD_EN			0x000100
+#define CFG_CD_ALLCH		0x008000
+#define CFG_CD_NUM_MASK		0x007000
+#define CFG_CD_LEN_MASK		0x000E00
+#define CFG_CD_NUM_1		0x000000
+#define CFG_CD_NUM_2		0x001000
+#define CFG_CD_LEN_128		0x000000
+#define CFG_CD_MASK			(CFG_CD_EN | CFG_CD_ALLCH | CFG_CD_NUM_MASK | CFG_CD_LEN_MASK)
+
+//THRSHLD_MSB holds bits 23:8 of the 24-bit threshold code, THRSHLD_LSB bits 7:0 in its
+//bits 15:8 (DCBLOCK, bits 3:0, left at 0)
+#define THRSHLD_MSB_DATA(code)	((((uint32_t)(code) >> 8) & 0xFFFF) << 8)
+#define THRSHLD_LSB_DATA(code)	(((uint32_t)(code) & 0xFF) << 16)
+#define ADC_THRESHOLD_MAX		0x7FFFFF
+
+//standby: HV channels at the parked rate, a single conversion over the threshold wakes up
+#define ADC_STANDBY_CHANNELS	((1 << 1) | (1 << 2))	//HV current and HV voltage
+#define ADC_STANDBY_CD			(CFG_CD_EN | CFG_CD_NUM_1 | CFG_CD_LEN_128)
+
+//register shadow cache, MODE to CH2_GCAL_LSB (CFG, THRSHLD, CHx_CFG and the calibration included)
+#define ADC_CACHE_FIRST		MODE
+#define ADC_CACHE_LAST		CH2_GCAL_LSB
+#define ADC_CACHE_SIZE		(ADC_CACHE_LAST - ADC_CACHE_FIRST + 1)
+
+//a multiple register RREG answers with the acknowledge word, the registers and the CRC word
+#define ADC_RREG_MAX		ADC_CACHE_SIZE
+#define ADC_RESPONSE_MAX_SIZE	(ADC_WORD_MAX_BYTES * (ADC_RREG_MAX + 2))
+
+//while frames are captured single register commands replace the NULL command of
+//the next frame and are answered in the following one
+#define ADC_COMMAND_FRAMES	3		//frames allowed for a command to be answered
+
+//DRDY watchdog: the ADC is reset and reconfigured when no DRDY was seen for
+//ADC_WATCHDOG_PERIODS data periods of the active profile plus the margin
+#define ADC_WATCHDOG_PERIODS	4
+#define ADC_WATCHDOG_MARGIN_US	1000
+#define ADC_WATCHDOG_BACKOFF_US	1000000		//wait after a failed recovery before the next one
+#define ADC_RESET_PULSE_MS		2			//RESET low, over 2048 CLKIN periods at 2 MHz
+
+//PGA settings in effect when a frame was converted, stamped in every sample
+#define ADC_GAIN_TAG(g0, g1, g2)	((uint16_t)(((g0) & 0x07) | (((g1) & 0x07) << 3) | (((g2) & 0x07) << 6)))
+#define ADC_GAIN_TAG_GAIN(tag, ch)	(((tag) >> (3 * (ch))) & 0x07)
+#define ADC_GAIN_TAG_MASK			0x01FF
+#define ADC_GAIN_TAG_SETTLING		0x8000	//digital filter still settling after a gain change
+#define ADC_GAIN_SETTLE_FRAMES		3		//conversions until the sinc3 filter output holds only new gain data
+
 #define ADC_CPOL			(SPI_POLARITY_LOW)
 #define ADC_CPHA			(SPI_PHASE_2EDGE)
 
@@ -62,6 +144,20 @@
 #define CH2_GCAL_LSB	0x17
 #define REGMAP_CRC		0x3E
 
+//STATUS word, first word of the frames not carrying a command response
+#define STATUS_LOCK			0x8000		//SPI interface locked
+#define STATUS_F_RESYNC		0x4000		//conversions resynchronized
+#define STATUS_REG_MAP		0x2000		//register map CRC changed, cleared by reading REGMAP_CRC
+#define STATUS_CRC_ERR		0x1000		//input CRC error, the command was ignored
+#define STATUS_CRC_TYPE		0x0800
+#define STATUS_RESET		0x0400		//reset happened, cleared by the MODE write
+#define STATUS_WLENGTH_MASK	0x0300
+#define STATUS_DRDY_MASK	0x0007		//new data of CHn in bit n
+#define STATUS_F_RESYNC_SHIFT	14
+#define STATUS_REG_MAP_SHIFT	13
+#define STATUS_CRC_ERR_SHIFT	12
+#define STATUS_RESET_SHIFT		10
+
 //MODE register default values
 #define MODE_REG_CRC_EN		0x000000
 #define MODE_RX_CRC_EN		0x000000
@@ -80,11 +176,24 @@
 #define MODE_WLENGTH_32_L	0x020000
 #define MODE_WLENGTH_32_M	0x030000
 #define MODE_DRDY_FMT_PULSE	0x000100
+#define MODE_REG_CRC_EN_ON	0x200000
+#define MODE_RX_CRC_EN_ON	0x100000
+#define MODE_CRC_TYPE_CCITT	0x000000
+#define MODE_CRC_TYPE_ANSI	0x080000
+#define MODE_WLENGTH_MASK	0x030000
+
+//frame CRC, checked on the MCU CRC peripheral with the polynomial of the selected type
+#define ADC_CRC_TYPE		MODE_CRC_TYPE_CCITT
+#define ADC_CRC_POLY_CCITT	0x1021
+#define ADC_CRC_POLY_ANSI	0x8005
+#define ADC_CRC_POLY		((ADC_CRC_TYPE == MODE_CRC_TYPE_ANSI) ? ADC_CRC_POLY_ANSI : ADC_CRC_POLY_CCITT)
+#define ADC_CRC_INIT		0xFFFF
 
 //CLOCK register default values
 #define CLOCK_CH2_EN		0x040000
 #define CLOCK_CH1_EN		0x020000
 #define CLOCK_CH0_EN		0x010000
+#define CLOCK_CH_EN(mask)	((uint32_t)((mask) & ADC_CHANNEL_MASK_ALL) << 16)
 #define CLOCK_TBM			0x000000
 #define CLOCK_OSR			0x000C00
 #define CLOCK_PWR			0x000200
@@ -93,7 +202,23 @@
 #define CLOCK_CH2_DIS		0x000000
 #define CLOCK_CH1_DIS		0x000000
 #define CLOCK_CH0_DIS		0x000000
+#define CLOCK_OSR_128		0x000000
+#define CLOCK_OSR_256		0x000400
+#define CLOCK_OSR_512		0x000800
+#define CLOCK_OSR_1024		0x000C00
+#define CLOCK_OSR_2048		0x001000
+#define CLOCK_OSR_4096		0x001400
+#define CLOCK_OSR_8192		0x001800
 #define CLOCK_OSR_16256		0x001C00
+#define CLOCK_PWR_VLP		0x000000
+#define CLOCK_PWR_LP		0x000100
+#define CLOCK_PWR_HR		0x000200
+
+//ADC CLKIN is generated by TIM16 from the 32 MHz timer clock, CLKIN = 32 MHz / (period + 1)
+#define ADC_CLKIN_TIMER_FREQ	32000000
+#define ADC_CLKIN_PERIOD_HR		3		//8 MHz, high resolution mode
+#define ADC_CLKIN_PERIOD_LP		7		//4 MHz, low power mode
+#define ADC_CLKIN_PERIOD_VLP	15		//2 MHz, very low power mode
 
 //GAIN register default values
 #define GAIN_PGA_GAIN2_1	0X000000
@@ -113,9 +238,80 @@
 #define ADC_CPOL			(SPI_POLARITY_LOW)
 #define ADC_CPHA			(SPI_PHASE_2EDGE)
 
+//data-rate profiles, data rate = CLKIN / 2 / OSR
+typedef enum {
+	ADC_PROFILE_PARKED,
+	ADC_PROFILE_PRECISION,
+	ADC_PROFILE_TRANSIENT,
+	ADC_PROFILE_BURST,
+	ADC_PROFILE_QTY
+} ADCprofileId;
+
+#define ADC_DEFAULT_PROFILE		ADC_PROFILE_PRECISION
+
+typedef struct {
+	uint8_t		wordBytes;			//2, 3 or 4
+	uint8_t		channelMask;		//enabled channels, bit n for CHn
+	uint8_t		frameSize;			//bytes read per DRDY
+	uint8_t		crcOffset;			//CRC word position, 0 when the frame is cut before it
+	uint8_t		channelOffset[3];	//channel word positions
+	uint8_t		codeShift;			//right shift of the masked word, codes come out in 24-bit units
+	bool		signExtended;		//32-bit sign-extended words, the codes are whole words
+	uint32_t	codeMask[3];		//bits of the byte reversed word holding the code, 0 if disabled
+	uint32_t	modeWlength;		//MODE WLENGTH field
+} ADCframeLayoutTypedef;
+
+typedef struct {
+	char		name[10];
+	uint32_t	clockOsr;		//CLOCK register OSR field
+	uint16_t	osr;			//oversampling ratio, modulator clocks per sample
+	uint32_t	clockPwr;		//CLOCK register PWR field
+	uint16_t	clkinPeriod;	//TIM16 period generating CLKIN
+	uint32_t	dataRate;		//samples per second
+} ADCprofileTypedef;
+
+//ADC outages detected by the DRDY watchdog
+typedef struct {
+	uint32_t	count;			//recoveries since power up
+	uint32_t	failures;		//recoveries that could not configure the ADC
+	uint32_t	duration;		//us without frames of the last outage, recovery included
+	uint32_t	resumeSequence;	//sequence number of the first frame after the last recovery
+} ADCoutageTypedef;
+
 uint8_t *ADCrawChannels(void);
 uint8_t ADCwriteReg(uint8_t reg, uint32_t data);
 uint8_t ADCinit(SPI_HandleTypeDef * hspi);
+void ADCcaptureFrame(uint32_t timestamp);
+void ADCcaptureComplete(SPI_HandleTypeDef * hspi);
+void ADCcaptureError(SPI_HandleTypeDef * hspi);
+uint32_t ADCframesDropped(void);
+uint32_t ADCnextSequence(void);
+uint32_t ADCsequenceCount(void);
+uint8_t ADCsetProfile(ADCprofileId id);
+ADCprofileId ADCgetProfile(void);
+const ADCprofileTypedef *ADCgetProfileInfo(ADCprofileId id);
+int8_t ADCfindProfile(const char *name);
+uint32_t ADCcrcErrors(void);
+uint16_t ADCcrc(const uint8_t *data, uint8_t size);
+bool ADCframeCrcValid(const uint8_t *frame);
+uint8_t ADCreadReg(uint8_t reg, uint16_t *value);
+uint8_t ADCreadRegs(uint8_t reg, uint8_t count, uint16_t *values);
+uint8_t ADCverifyRegisters(void);
+uint8_t ADCcheckRegisters(void);
+uint8_t ADCsetGain(uint8_t log2GainCH0, uint8_t log2GainCH1, uint8_t log2GainCH2);
+uint16_t ADCgetGainTag(void);
+uint16_t ADCframeGainTag(void);
+uint8_t ADCwriteCalibration(uint8_t channel, int32_t offset, uint32_t gain);
+uint8_t ADCwritePhase(uint8_t channel, int16_t phase);
+uint8_t ADCsetLayout(uint8_t channelMask, uint8_t wordBits);
+const ADCframeLayoutTypedef *ADCgetLayout(void);
+void ADCcomputeLayout(ADCframeLayoutTypedef *layout, uint8_t channelMask, uint32_t wlength);
+void ADCwatchdog(void);
+uint8_t ADCenterStandby(uint32_t thresholdCode);
+uint8_t ADCexitStandby(void);
+bool ADCinStandby(void);
+const ADCoutageTypedef *ADCgetOutage(void);
+void ADCrequestRecovery(void);
 
 #endif /* INC_ADC_SPI_H_ */
 
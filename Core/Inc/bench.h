@@ -0,0 +1,44 @@
+/*******************************************************************************
+  * File Name			: bench.h
+  * Description			: This module contains the definitions of constants and
+  * 					  functions related to the on-target benchmarks of the
+  * 					  sample processing routines.
+  *
+  * Date				: October 17, 2026
+  ******************************************************************************
+  */
+#ifndef INC_BENCH_H_
+#define INC_BENCH_H_
+
+#include "common.h"
+#include "main.h"
+#include "stdbool.h"
+#include <stdio.h>
+
+#define BENCH_FRAMES				64		//synthetic frames per benchmark pass
+#define BENCH_PASSES				16
+
+//max deviation (micro-units) allowed between the fixed-point and the double conversion
+#define BENCH_FIXED_MAX_ERROR		1
+
+#define BENCH_FILTER_SAMPLES		4096	//input samples per filter measurement
+
+//frames on which the raw code rules may disagree with the micro-units ones: the converted
+//values are rounded, a code right at a threshold can fall on either side
+#define BENCH_RULE_MAX_MISMATCH		1
+
+//compliance monitor step: constant HV voltage (uV) and power (W), twice the limit used
+#define BENCH_MONITOR_VOLTAGE		400000000
+#define BENCH_MONITOR_POWER			40000
+
+//windowed statistics: input rate, samples fed (a multiple of the bucket at that rate) and the
+//RMS deviation allowed by the shift applied before squaring
+#define BENCH_STATS_RATE			1000
+#define BENCH_STATS_SAMPLES			4000
+#define BENCH_STATS_MAX_RMS_ERROR	(2 << STATS_SQUARE_SHIFT)
+
+void benchCycleCounterInit(void);
+uint32_t benchCycles(void);
+void benchRun(void);
+
+#endif /* INC_BENCH_H_ */
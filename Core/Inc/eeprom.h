@@ -19,15 +19,67 @@
 
 #define EEPROM_MAX_LOG			100 //maximum logs that will be stored in the EEPROM
 
+//every log record starts with a LEB128 varint key (1 to 5 bytes) holding the
+//microseconds since the previous record (up to EEPROM_RECORD_DELTA_MAX, longer deltas are split
+//with EEPROM_EVENT_TIME records) and the record type in the low bits.
+//layout record: key, EEPROM_LOG_FORMAT and fields (1), first record of every log, logs not
+//opening with it (like the fixed 8-byte records of older firmware) are not read
+//sample record: key, voltage (2) and current (2) when in the fields, PGA gains and ADC fault flag (1)
+//gap record: key, first lost sequence (varint), lost frames (varint)
+//event record: key, event code (varint), event value (varint)
+#define EEPROM_VARINT_MAX_SIZE	5
+#define EEPROM_RECORD_MAX_SIZE	(3 * EEPROM_VARINT_MAX_SIZE)
+#define EEPROM_RECORD_TYPE_BITS	2
+#define EEPROM_RECORD_TYPE_MASK	((1 << EEPROM_RECORD_TYPE_BITS) - 1)
+#define EEPROM_RECORD_SAMPLE	0
+#define EEPROM_RECORD_GAP		1
+#define EEPROM_RECORD_LAYOUT	2
+#define EEPROM_RECORD_EVENT		3
+#define EEPROM_EVENT_ADC_OUTAGE	0		//ADC reset by the DRDY watchdog, value: us without frames
+#define EEPROM_EVENT_VIOLATION_START	1	//FSAE limit violation started, value: window average power, W
+#define EEPROM_EVENT_VIOLATION_END		2	//FSAE limit violation ended, value: duration, ms
+#define EEPROM_EVENT_PACK_ESTIMATE		3	//pack open-circuit voltage and resistance, EEPROM_ESTIMATE_VALUE
+#define EEPROM_EVENT_TIME				4	//time skip, its key carries part of a delta over EEPROM_RECORD_DELTA_MAX, value: 0
+#define EEPROM_EVENT_HISTOGRAM			16	//session histogram bin, EEPROM_HISTOGRAM_EVENT, value: samples
+#define EEPROM_HISTOGRAM_BINS			32
+#define EEPROM_HISTOGRAM_EVENT(histogram, bin)	(EEPROM_EVENT_HISTOGRAM + (histogram) * EEPROM_HISTOGRAM_BINS + (bin))
+#define EEPROM_ESTIMATE_VALUE(decivolts, decimilliohms)	(((uint32_t)(decivolts) << 16) | ((decimilliohms) & 0xFFFF))
+#define EEPROM_FIELD_VOLTAGE	0x01
+#define EEPROM_FIELD_CURRENT	0x02
+#define EEPROM_FIELDS_ALL		(EEPROM_FIELD_VOLTAGE | EEPROM_FIELD_CURRENT)
+#define EEPROM_LOG_FORMAT		0x10		//record format version, high nibble of the layout byte
+#define EEPROM_LOG_FORMAT_MASK	0xF0
+#define EEPROM_RECORD_DELTA_MAX	((1UL << (32 - EEPROM_RECORD_TYPE_BITS)) - 1)	//longest delta of a key, about 17.9 min
+#define EEPROM_RECORD_KEY(delta, type)	(((uint32_t)(delta) << EEPROM_RECORD_TYPE_BITS) | (type))
+#define EEPROM_RECORD_GAINS(voltageGain, currentGain)	((uint8_t)((((voltageGain) & 0x07) << 4) | ((currentGain) & 0x07)))
+#define EEPROM_RECORD_ADC_FAULT		0x08		//gains byte flag: the ADC STATUS marked the sample suspect
+
 //size (in Bytes) of the EEPROM identification page reserved for ADC calibration parameters and other stuff
 #define EEPROM_PARAMETERS_SIZE	EEPROM_PAGESIZE - (3 * EEPROM_MAX_LOG)
 
+//parameters area layout, offsets from the start of the area
+#define EEPROM_PARAM_CALIBRATION	0
+#define EEPROM_PARAM_ENERGY			64		//energy totals of the last log
+
 typedef struct {
 	uint32_t startAddress;
 	uint32_t endAddress;
 	uint32_t size;
 } logMetaData;
 
+typedef struct {
+	uint8_t type;			//EEPROM_RECORD_x
+	uint8_t fields;			//EEPROM_FIELD_x held by the sample records
+	uint32_t delta;			//us since the previous record
+	uint16_t voltage;		//hundredths
+	uint16_t current;		//hundredths
+	uint8_t gains;			//EEPROM_RECORD_GAINS
+	uint32_t startSequence;	//gap: first lost frame
+	uint32_t count;			//gap: lost frames
+	uint32_t event;			//event: EEPROM_EVENT_x
+	uint32_t value;			//event: value of the event
+} EEPROMlogRecordTypedef;
+
 typedef struct {
 	uint32_t logQty;
 	float memoryOccupied;
@@ -35,11 +87,15 @@ typedef struct {
 } eepromStatisticsTypeDef;
 
 EepromOperations EEPROMgetLogMetaData(void);
-EepromOperations EEPROMstartLog(void);
-EepromOperations EEPROMlogData(uint32_t timestamp, double voltage, double current);
+EepromOperations EEPROMstartLog(uint8_t fields);
+EepromOperations EEPROMlogData(uint32_t timestamp, int32_t voltage, int32_t current, uint8_t gains);
+EepromOperations EEPROMlogGap(uint32_t startSequence, uint32_t count);
+EepromOperations EEPROMlogEvent(uint32_t event, uint32_t value);
 EepromOperations EEPROMendLog(void);
 EepromOperations EEPROMreadData(uint8_t* dataBuffer, uint32_t address, uint32_t size);
 uint8_t *EEPROMextraInfo(void);
+EepromOperations EEPROMwriteParameters(const uint8_t *data, uint16_t offset, uint16_t size);
+uint32_t EEPROMlogCount(void);
 void getLogInfo(uint32_t logId, uint32_t* startAddress, uint32_t* endAddress, uint32_t* size);
 void initIdPage(void);
 void getEEPROMstatistics(eepromStatisticsTypeDef *eepromStat);
@@ -14,6 +14,7 @@
 
 #include "common.h"
 #include "main.h"
+#include "spi.h"
 
 /* M95M04-DR SPI EEPROM defines */
 #define EEPROM_WREN		0x06  //Write Enable instruction
@@ -35,8 +36,9 @@
 #define EEPROM_CS_GPIO_Port	   GPIOB		//Port to which EEPROM CS pin is connected
 #define EEPROM_CS_Pin          GPIO_PIN_5	//Pin to which EEPROM CS pin is connected
 
-#define EEPROM_CS_HIGH()    HAL_GPIO_WritePin(EEPROM_CS_GPIO_Port, EEPROM_CS_Pin, GPIO_PIN_SET)
-#define EEPROM_CS_LOW()     HAL_GPIO_WritePin(EEPROM_CS_GPIO_Port, EEPROM_CS_Pin, GPIO_PIN_RESET)
+//the shared SPI bus is owned for the whole time the chip select is low
+#define EEPROM_CS_HIGH()    do { HAL_GPIO_WritePin(EEPROM_CS_GPIO_Port, EEPROM_CS_Pin, GPIO_PIN_SET); spiBusUnlock(); } while (0)
+#define EEPROM_CS_LOW()     do { spiBusLock(); HAL_GPIO_WritePin(EEPROM_CS_GPIO_Port, EEPROM_CS_Pin, GPIO_PIN_RESET); } while (0)
 
 #define EEPROM_CPOL			(SPI_POLARITY_LOW)
 #define EEPROM_CPHA			(SPI_PHASE_1EDGE)
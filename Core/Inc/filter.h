@@ -0,0 +1,43 @@
+/*******************************************************************************
+  * File Name			: filter.h
+  * Description			: This module contains the definitions of constants and
+  * 					  functions related to the low-pass filter and decimation
+  * 					  stage between the converted samples and the log.
+  *
+  * Date				: October 17, 2026
+  ******************************************************************************
+  */
+#ifndef INC_FILTER_H_
+#define INC_FILTER_H_
+
+#include "common.h"
+#include "main.h"
+#include "stdbool.h"
+
+#define FILTER_CHANNELS				3
+#define FILTER_DEFAULT_RATE			10		//samples per second kept by the low speed log
+
+//CIC integrators and combs wrap modulo 2^64, the output |x| * R^3 must fit in
+//63 bits for int32 inputs, so R^3 < 2^32
+#define FILTER_CIC_ORDER			3
+#define FILTER_CIC_MAX_DECIMATION	1600
+
+//droop compensated low-pass, decimates the CIC output by 2. Q15 coefficients,
+//the taps count must be even so the delay line is read in 16-bit pairs
+#define FILTER_FIR_TAPS				28
+#define FILTER_FIR_DECIMATION		2
+#define FILTER_Q15_SHIFT			15
+
+//FIR data resolution per channel in micro-units, int16 covers +-32767 steps
+#define FILTER_STEP_SUPPLY_CURRENT	1000	//1 mA
+#define FILTER_STEP_HV_CURRENT		20000	//20 mA
+#define FILTER_STEP_HV_VOLTAGE		20000	//20 mV
+
+void filterConfigure(uint32_t inputRate, uint16_t outputRate);
+bool filterProcess(const int32_t *input, int32_t *output);
+uint32_t filterGetInputRate(void);
+uint16_t filterGetOutputRate(void);
+uint32_t filterGetDecimation(void);
+uint32_t filterGetGroupDelay(void);
+
+#endif /* INC_FILTER_H_ */
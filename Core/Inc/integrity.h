@@ -12,6 +12,7 @@
 #define INC_INTEGRITY_H_
 
 #include "common.h"
+#include "timebase.h"
 
 
 /************************** Error Handling Definition **************************/
@@ -21,6 +22,9 @@ typedef enum {
 	SPI_WRITE_ERROR,
 	SPI_READ_ERROR,
 	SPI_MODE_CONFG_ERROR,
+	ADC_RESET_ERROR,
+	ADC_REGMAP_CRC_ERROR,
+	ADC_INPUT_CRC_ERROR,
 
 } ERROR_CODES;
 
@@ -17,17 +17,38 @@
 #include "eeprom.h"
 #include "sd.h"
 #include "adc.h"
+#include "queue.h"
+#include "adc_spi.h"
+#include "filter.h"
+#include "monitor.h"
+#include "stats.h"
 
 
 #define HS_BUFFER_SIZE			250
-#define LS_LOG_SAMPLE_INTERVAL	25
 #define HS_LOG_SAMPLE_QTY		HS_BUFFER_SIZE/2
+#define LOG_DRAIN_BATCH			16		//max queued samples processed per dataLogRoutine call
 
 #define LOG_HV_VOLTAGE_THRSH	5.0
 
 #define MAX_POWER		85000
 #define MAX_VOLTAGE		600
 
+//thresholds in the fixed-point micro-units domain of getADCConvertedFixed
+#define LOG_HV_VOLTAGE_THRSH_FIXED	((int32_t)(LOG_HV_VOLTAGE_THRSH * ADC_FIXED_SCALE))
+#define MAX_POWER_FIXED				((int64_t)MAX_POWER * ADC_FIXED_SCALE * ADC_FIXED_SCALE)
+#define MAX_VOLTAGE_FIXED			((int32_t)MAX_VOLTAGE * ADC_FIXED_SCALE)
+
+//rules and trigger evaluated on raw codes: the thresholds above are converted once for
+//every PGA setting, so a gain change only selects other entries. The HV voltage scale is
+//positive, the sign of the power is folded into the current code
+typedef struct {
+	int32_t		startVoltage[ADC_GAIN_QTY];		//HV voltage code of LOG_HV_VOLTAGE_THRSH
+	int32_t		maxVoltage[ADC_GAIN_QTY];		//HV voltage code of MAX_VOLTAGE
+	int64_t		maxPower[ADC_GAIN_QTY][ADC_GAIN_QTY];	//code product of MAX_POWER, [voltage gain][current gain]
+	bool		negateCurrent;					//voltage and current scales of opposite sign
+	bool		valid;
+} logRulesTypedef;
+
 typedef enum
 {
     PENDING,
@@ -37,15 +58,40 @@ typedef enum
 } logDirective ;
 
 typedef struct log{
-	double 			current;
-	double 			voltage;
-	uint32_t 		timestamp;
+	int32_t 		current;		//uA
+	int32_t 		voltage;		//uV
+	uint32_t 		timestamp;		//us since the log start
+	uint8_t			gains;			//PGA gains of the sample and ADC fault flag, EEPROM_RECORD_GAINS
+	bool			filtered;		//a low speed (filtered and decimated) sample is due at this one
+	int32_t			filteredCurrent;
+	int32_t			filteredVoltage;
+	uint32_t		gapStart;		//first frame lost right before this sample
+	uint32_t		gapCount;		//frames lost right before this sample, 0 if none
+	uint32_t		outage;			//us the ADC was stalled right before this sample, 0 if none
+	monitorEvent	event;			//compliance monitor event at this sample
+	uint32_t		eventValue;		//EEPROM_EVENT_VIOLATION_x value
 	bool			ruleVoided;
 	logDirective	directive;
 } logElementTypedef;
 
-void dataLogRoutine(uint32_t timestamp, uint8_t *ADCnewData);
+//sample-loss accounting, counted since power up
+typedef struct {
+	uint32_t	framesAcquired;		//DRDY seen by the acquisition interrupt
+	uint32_t	framesProcessed;	//frames that reached the logging loop
+	uint32_t	framesLost;			//frames missing from the sequence
+	uint32_t	gaps;				//sequence breaks
+	uint32_t	gapRecords;			//gap records written into the log
+	uint32_t	recordsLogged;		//sample records written into the log
+	uint32_t	storeErrors;		//EEPROM writes that failed
+	uint32_t	backlogHighWater;	//most records written by one logToMemory call
+} logStatsTypedef;
+
+void dataLogRoutine(void);
 void requestLogEnd();
 bool isLoggingOn();
+void logGetStats(logStatsTypedef *stats);
+void logUpdateThresholds(void);
+bool checkRule(int32_t voltageCode, int32_t currentCode, uint16_t gainTag);
+bool logStartCondition(int32_t voltageCode, uint16_t gainTag);
 
 #endif /* INC_LOG_H_ */
@@ -11,8 +11,128 @@
 #ifndef INC_MONITOR_H_
 #define INC_MONITOR_H_
 
+#include "common.h"
+#include "main.h"
+#include "stdbool.h"
+#include <stdio.h>
+#include "eeprom.h"
 
+//the moving averages are running sums over a ring of buckets: samples are summed into the
+//current bucket and, once it is full, the bucket leaving the window is subtracted. The cost
+//per sample does not depend on the window length
+#define MONITOR_BUCKET_MS			4		//time summed per bucket, at least one sample
+#define MONITOR_BUCKETS				256		//ring length, power of two, bounds the window
+#define MONITOR_POWER_SHIFT			20		//sample power (uV * uA, pW) kept in 2^20 pW units
 
-#endif /* INC_MONITOR_H_ */
+#if (MONITOR_BUCKETS & (MONITOR_BUCKETS - 1)) != 0
+#error "MONITOR_BUCKETS must be a power of two"
+#endif
 
-#include "common.h"
+//FSAE limits: the window average of the HV power or voltage above its limit for the
+//minimum duration is a violation, until the average falls back below the limit
+#define MONITOR_DEFAULT_WINDOW_MS	500
+#define MONITOR_DEFAULT_DURATION_MS	100
+#define MONITOR_DEFAULT_POWER		80000	//W
+#define MONITOR_DEFAULT_VOLTAGE		600		//V
+#define MONITOR_POWER_MAX			2000000	//W, highest power limit, the averages are kept in mW
+
+typedef enum
+{
+	MONITOR_NO_EVENT,
+	MONITOR_VIOLATION_START,
+	MONITOR_VIOLATION_END,
+	MONITOR_ESTIMATE			//periodic pack estimate, given by monitorEstimateDue
+} monitorEvent;
+
+typedef struct {
+	uint32_t	windowMs;		//moving average window
+	uint32_t	durationMs;		//time above a limit before a violation starts
+	uint32_t	powerLimit;		//W
+	uint32_t	voltageLimit;	//V
+} monitorConfigTypedef;
+
+//violations counted since power up, durations in ms
+typedef struct {
+	uint32_t	violations;
+	uint32_t	longest;
+	uint32_t	total;
+	uint32_t	lastDuration;	//duration of the last violation that ended
+	int32_t		peakPower;		//highest window average, mW
+	bool		active;			//a violation is in progress
+} monitorStatsTypedef;
+
+//energy and charge integrator, fed with every sample and the exact time since the previous
+//one. Power is kept in 2^MONITOR_POWER_SHIFT pW, energy in 2^MONITOR_ENERGY_SHIFT pW.us
+//(about 1 nJ, up to 2.7 MWh) and charge in uA.us (pC, up to 2.5 kAh)
+#define MONITOR_ENERGY_SHIFT		30
+#define MONITOR_MAX_DT_US			1000000		//longest time a sample is held, bounds the products
+#define MONITOR_ENERGY_SIGNATURE	0x4E524731	//"NRG1"
+
+#define MONITOR_ENERGY_WH(energy)	((double)(energy) * (double)(1ULL << MONITOR_ENERGY_SHIFT) / 3.6e21)	//1 Wh is 3.6e21 pW.us
+#define MONITOR_CHARGE_AH(charge)	((double)(charge) / 3.6e15)
+
+//totals of a session, discharge (positive HV current) and regen kept apart as magnitudes
+typedef struct {
+	int64_t		dischargeEnergy;
+	int64_t		regenEnergy;
+	int64_t		dischargeCharge;
+	int64_t		regenCharge;
+	uint64_t	duration;		//us integrated
+} monitorEnergyTypedef;
+
+//totals stored at EEPROM_PARAM_ENERGY when a log ends
+typedef struct {
+	uint32_t	signature;
+	uint32_t	logId;			//log the totals belong to
+	monitorEnergyTypedef totals;
+} monitorEnergyRecordTypedef;
+
+//pack estimator: recursive least squares with forgetting on the bucket means, model
+//V = OCV - R * I with the HV current positive in discharge. The covariance trace is
+//bounded so it does not wind up while the current holds steady and R is not observable
+#define MONITOR_RLS_LAMBDA			0.998f		//forgetting factor per bucket, about 2 s of memory
+#define MONITOR_RLS_LAMBDA_MIN		0.9f
+#define MONITOR_RLS_P0				1000.0f		//initial covariance of both parameters
+#define MONITOR_RLS_TRACE_MAX		10000.0f
+#define MONITOR_RLS_MIN_UPDATES		500			//updates before the estimate is logged
+#define MONITOR_RLS_LOG_MS			1000		//estimate logging period
+
+typedef struct {
+	float		ocv;			//V
+	float		resistance;		//ohm
+	uint32_t	updates;
+} monitorEstimateTypedef;
+
+//violation statistics and pack estimator kept across a benchmark run on the monitor
+typedef struct {
+	monitorStatsTypedef stats;
+	int64_t		peak;
+	float		lambda;
+	float		theta[2];
+	float		covariance[3];
+	monitorEstimateTypedef estimate;
+	uint32_t	estimateBuckets;
+	bool		estimatePending;
+} monitorSnapshotTypedef;
+
+uint8_t monitorConfigure(const monitorConfigTypedef *config);
+const monitorConfigTypedef *monitorGetConfig(void);
+void monitorSetRate(uint32_t dataRate);
+uint32_t monitorGetRate(void);
+monitorEvent monitorProcess(int32_t voltage, int32_t current);
+int32_t monitorAveragePower(void);
+int32_t monitorAverageVoltage(void);
+const monitorStatsTypedef *monitorGetStats(void);
+const monitorEstimateTypedef *monitorGetEstimate(void);
+bool monitorEstimateDue(void);
+uint8_t monitorSetForgetting(float lambda);
+float monitorGetForgetting(void);
+void monitorEnergyReset(void);
+void monitorIntegrate(int32_t voltage, int32_t current, uint32_t timestamp);
+const monitorEnergyTypedef *monitorGetEnergy(void);
+uint8_t monitorSaveEnergy(uint32_t logId);
+const monitorEnergyRecordTypedef *monitorLoadEnergy(void);
+void monitorSave(monitorSnapshotTypedef *snapshot);
+void monitorRestore(const monitorSnapshotTypedef *snapshot);
+
+#endif /* INC_MONITOR_H_ */
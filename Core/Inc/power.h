@@ -15,12 +15,21 @@
 #include "stdbool.h"
 #include "main.h"
 
+//standby: entered after POWER_STANDBY_DELAY_MS without a log. The core sleeps until the
+//ADC current detect sees the HV current or the HV voltage over its wake threshold
+#define POWER_STANDBY_DELAY_MS		10000
+#define POWER_WAKE_CURRENT			2.0		//A on the HV current channel
+#define POWER_WAKE_CURRENT_FIXED	((int32_t)(POWER_WAKE_CURRENT * ADC_FIXED_SCALE))
 
 
 /************************** Power Routines **************************/
 void initPowerModule (void);
 void checkPowerEnState (void);
 bool isWaitingToTurnOff (void);
+void checkStandby (void);
+void setStandbyEnabled (bool enabled);
+bool isStandbyEnabled (void);
+uint32_t getWakeCount (void);
 
 
 #endif /* INC_POWER_H_ */
@@ -0,0 +1,55 @@
+/*******************************************************************************
+  * File Name			: queue.h
+  * Description			: This module contains the definitions of constants and
+  * 					  functions related to the sample queue between the
+  * 					  ADC acquisition interrupts and the logging loop.
+  *
+  * Date				: October 17, 2026
+  ******************************************************************************
+  */
+#ifndef INC_QUEUE_H_
+#define INC_QUEUE_H_
+
+#include "common.h"
+#include "main.h"
+#include "adc_spi.h"
+
+//must be a power of two, indexes are free running and masked. Sized for the burst
+//profile: 256 frames are 8.2 ms at 31250 SPS, longer than an EEPROM page write (5 ms)
+#define SAMPLE_QUEUE_SIZE	256
+#define SAMPLE_QUEUE_MASK	(SAMPLE_QUEUE_SIZE - 1)
+
+#if (SAMPLE_QUEUE_SIZE & SAMPLE_QUEUE_MASK) != 0
+#error "SAMPLE_QUEUE_SIZE must be a power of two"
+#endif
+
+typedef struct {
+	uint32_t	sequence;		//ADCnextSequence number, consecutive unless frames were lost
+	uint32_t	timestamp;
+	uint8_t		frame[ADC_FRAME_SIZE] __ALIGNED(4);		//word aligned, 32-bit words are read whole
+	uint16_t	gainTag;		//ADC_GAIN_TAG of the PGA settings the frame was converted with
+	bool		response;		//the first word is a command response instead of STATUS
+} sampleTypedef;
+
+typedef struct {
+	uint32_t	count;
+	uint32_t	highWater;
+	uint32_t	overruns;
+} sampleQueueStatsTypedef;
+
+/* Producer side (acquisition interrupts) */
+sampleTypedef *sampleQueueProducerSlot(void);
+void sampleQueueCommit(void);
+void sampleQueuePush(uint32_t sequence, uint32_t timestamp, uint16_t gainTag, uint8_t *frame);
+
+/* Consumer side (main loop) */
+sampleTypedef *sampleQueuePeek(void);
+void sampleQueueRelease(void);
+sampleTypedef *sampleQueuePeekBatch(uint16_t *count);
+void sampleQueueReleaseBatch(uint16_t count);
+uint32_t sampleQueueCount(void);
+
+void sampleQueueReset(void);
+void sampleQueueGetStats(sampleQueueStatsTypedef *stats);
+
+#endif /* INC_QUEUE_H_ */
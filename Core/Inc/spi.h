@@ -20,5 +20,14 @@
 void spiWrite(SPI_HandleTypeDef* handler, uint8_t* pData, uint16_t size, uint32_t tout);
 void spiRead(SPI_HandleTypeDef* handler, uint8_t* pData, uint16_t size, uint32_t tout);
 void checkAndConfigureSpiMode(SPI_HandleTypeDef* handler, uint8_t cpol, uint8_t cpha);
+void checkAndConfigureSpiModeFromISR(SPI_HandleTypeDef* handler, uint8_t cpol, uint8_t cpha);
+
+/************************** SPI Bus Arbitration **************************/
+
+void spiBusLock(void);
+void spiBusUnlock(void);
+bool spiBusTryLockFromISR(void);
+void spiBusUnlockFromISR(void);
+void spiSetBusReleaseHook(void (*hook)(void));
 
 #endif /* INC_SPI_H_ */
@@ -0,0 +1,97 @@
+/*******************************************************************************
+  * File Name			: stats.h
+  * Description			: This module contains the definitions of constants and
+  * 					  functions related to the windowed statistics of the
+  * 					  measured channels and of the HV power.
+  *
+  * Date				: October 17, 2026
+  ******************************************************************************
+  */
+#ifndef INC_STATS_H_
+#define INC_STATS_H_
+
+#include "common.h"
+#include "main.h"
+#include "stdbool.h"
+#include <stdio.h>
+#include "eeprom.h"
+
+//series: the three ADC channels (SUPPLY_CURRENT_CH, HV_CURRENT_CH, HV_VOLTAGE_CH) and the HV power
+#define STATS_SERIES				4
+#define STATS_POWER					3
+#define STATS_POWER_SHIFT			30		//power samples (uV * uA, pW) kept in 2^30 pW, about 1 mW
+#define STATS_SQUARE_SHIFT			8		//samples are squared after this shift, the sums stay in 64 bits
+
+//every window is STATS_BUCKETS buckets and moves by one bucket. The buckets of a window are
+//as long as the next shorter window, so the completed buckets cascade from window to window:
+//100 ms in 10 ms buckets, 1 s in 100 ms buckets and 10 s in 1 s buckets. Only the 10 ms
+//bucket is updated per sample. The 10 ms bucket is a whole number of samples, at rates that
+//are not a multiple of 100 SPS the windows are shorter (at least one sample, below 100 SPS
+//they stretch), statsWindowMs gives their real length
+#define STATS_BUCKETS				10
+#define STATS_BUCKET_MS				10		//bucket of the shortest window
+#define STATS_WINDOWS				3
+#define STATS_SESSION				STATS_WINDOWS	//window id of the session statistics
+
+typedef struct {
+	int32_t		min;
+	int32_t		max;
+	int64_t		sum;
+	double		sumSquares;		//of the samples shifted by STATS_SQUARE_SHIFT
+} statsAggregateTypedef;
+
+//statistics of a series in its units: uA, uV or 2^STATS_POWER_SHIFT pW
+typedef struct {
+	int32_t		min;
+	int32_t		max;
+	int32_t		mean;
+	int32_t		rms;
+} statsResultTypedef;
+
+//session histograms of the HV power, current and voltage: STATS_HIST_BINS bins of 2^shift
+//units each, the first one starting offset bins below zero. The bin of a sample is a shift,
+//an add and a saturation, values out of range fall in the first or the last bin
+#define STATS_HIST_BINS				32
+#define STATS_HIST_QTY				3
+#define STATS_HIST_POWER			0
+#define STATS_HIST_CURRENT			1
+#define STATS_HIST_VOLTAGE			2
+#define STATS_HIST_POWER_SHIFT		22		//about 4.5 kW in 2^STATS_POWER_SHIFT pW units, -36 kW to 108 kW
+#define STATS_HIST_POWER_OFFSET		8
+#define STATS_HIST_CURRENT_SHIFT	25		//about 33.5 A, -537 A to 537 A
+#define STATS_HIST_CURRENT_OFFSET	16
+#define STATS_HIST_VOLTAGE_SHIFT	25		//about 33.5 V, 0 to 1074 V
+#define STATS_HIST_VOLTAGE_OFFSET	0
+
+#if (1 << 5) != STATS_HIST_BINS || STATS_HIST_BINS != EEPROM_HISTOGRAM_BINS
+#error "STATS_HIST_BINS must match the 5-bit saturation of the bin lookup and the log event codes"
+#endif
+
+typedef struct {
+	const char	*name;
+	uint8_t		shift;
+	uint8_t		offset;
+	double		unit;			//engineering units per unit of the series
+} statsHistogramInfoTypedef;
+
+//session statistics and histograms kept across a benchmark run on the statistics
+typedef struct {
+	statsAggregateTypedef session[STATS_SERIES];
+	uint32_t	sessionCount;
+	uint32_t	histograms[STATS_HIST_QTY][STATS_HIST_BINS];
+} statsSnapshotTypedef;
+
+#define STATS_POWER_TO_W(x)			((double)(x) * (double)(1ULL << STATS_POWER_SHIFT) / 1e12)
+
+void statsSetRate(uint32_t dataRate);
+uint32_t statsGetRate(void);
+void statsReset(void);
+void statsProcess(const int32_t *channels);
+uint32_t statsGet(uint8_t window, statsResultTypedef *result);
+uint32_t statsWindowMs(uint8_t window);
+const uint32_t *statsGetHistogram(uint8_t histogram);
+const statsHistogramInfoTypedef *statsGetHistogramInfo(uint8_t histogram);
+void statsSave(statsSnapshotTypedef *snapshot);
+void statsRestore(const statsSnapshotTypedef *snapshot);
+
+#endif /* INC_STATS_H_ */
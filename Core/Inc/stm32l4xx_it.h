@@ -57,6 +57,8 @@ void PendSV_Handler(void);
 void SysTick_Handler(void);
 void EXTI3_IRQHandler(void);
 void EXTI4_IRQHandler(void);
+void DMA1_Channel2_IRQHandler(void);
+void DMA1_Channel3_IRQHandler(void);
 void DMA1_Channel6_IRQHandler(void);
 void EXTI9_5_IRQHandler(void);
 void USART2_IRQHandler(void);
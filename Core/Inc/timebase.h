@@ -0,0 +1,23 @@
+/*******************************************************************************
+  * File Name			: timebase.h
+  * Description			: This module contains the definitions of constants and
+  * 					  functions related to the microsecond timebase used to
+  * 					  timestamp the ADC samples.
+  *
+  * Date				: October 17, 2026
+  ******************************************************************************
+  */
+#ifndef INC_TIMEBASE_H_
+#define INC_TIMEBASE_H_
+
+#include "common.h"
+#include "main.h"
+#include "stdbool.h"
+
+void timebaseInit(void);
+uint32_t timebaseMicros(void);
+uint64_t timebaseMicros64(void);
+void timebaseSleepEnter(void);
+void timebaseSleepExit(void);
+
+#endif /* INC_TIMEBASE_H_ */
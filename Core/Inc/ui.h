@@ -16,6 +16,12 @@
 #include "integrity.h"
 #include "stdbool.h"
 #include "eeprom.h"
+#include "bench.h"
+#include "adc_spi.h"
+#include "adc.h"
+#include "log.h"
+#include "power.h"
+#include "ctype.h"
 
 typedef struct userInterfaceMenu{
 	struct userInterfaceMenu *parent;
@@ -10,11 +10,55 @@
 
 #include "adc_spi.h"
 #include "adc.h"
-#include <math.h>
+#include "eeprom.h"
+#include "queue.h"
+#include <stddef.h>
+#include <string.h>
+
+#define ADC_GAIN_ROW(divider)	{ \
+	ADC_SCALE_Q(divider, 0), ADC_SCALE_Q(divider, 1), ADC_SCALE_Q(divider, 2), ADC_SCALE_Q(divider, 3), \
+	ADC_SCALE_Q(divider, 4), ADC_SCALE_Q(divider, 5), ADC_SCALE_Q(divider, 6), ADC_SCALE_Q(divider, 7) }
+
+#define ADC_GAIN_ROW_DOUBLE(divider)	{ \
+	ADC_UNITS_PER_CODE(divider, 0), ADC_UNITS_PER_CODE(divider, 1), ADC_UNITS_PER_CODE(divider, 2), ADC_UNITS_PER_CODE(divider, 3), \
+	ADC_UNITS_PER_CODE(divider, 4), ADC_UNITS_PER_CODE(divider, 5), ADC_UNITS_PER_CODE(divider, 6), ADC_UNITS_PER_CODE(divider, 7) }
+
+//per channel and PGA setting scale factors, the HV current sign is folded in
+const int64_t ADCscaleTable[3][ADC_GAIN_QTY] = {
+	[SUPPLY_CURRENT_CH] = ADC_GAIN_ROW(SUPPLY_I_SHUNT_RESISTANCE),
+	[HV_CURRENT_CH] = ADC_GAIN_ROW(-SHUNT_RESISTANCE),
+	[HV_VOLTAGE_CH] = ADC_GAIN_ROW(VOLTAGE_DIVIDER),
+};
+
+const double ADCscaleTableDouble[3][ADC_GAIN_QTY] = {
+	[SUPPLY_CURRENT_CH] = ADC_GAIN_ROW_DOUBLE(SUPPLY_I_SHUNT_RESISTANCE),
+	[HV_CURRENT_CH] = ADC_GAIN_ROW_DOUBLE(-SHUNT_RESISTANCE),
+	[HV_VOLTAGE_CH] = ADC_GAIN_ROW_DOUBLE(VOLTAGE_DIVIDER),
+};
 
-extern uint8_t ADCgain[3];
 double ADCconvertedChannels[3];
-extern uint8_t ADCrawData[ADC_WORD_SIZE/8 * 5];
+int32_t ADCconvertedFixed[3];
+int32_t ADCconvertedCodes[3];		//codes the values in ADCconvertedFixed were converted from
+ADChealthTypedef ADChealth = {0};
+int64_t ADCscaleQ[3];			//micro-units per code in Q(ADC_SCALE_SHIFT)
+double ADCscale[3];				//units per code
+uint16_t ADCconvertedGainTag = 0;	//gains of the values in ADCconvertedFixed
+ADCcalibrationTypedef ADCcalibration;
+
+//ring buffers of the phase measurement, frame k after the oldest one
+#define ADC_PHASE_AT(ring, oldest, k)	((ring)[((oldest) + (k)) & (ADC_PHASE_FRAMES - 1)])
+
+#if (ADC_PHASE_FRAMES & (ADC_PHASE_FRAMES - 1)) != 0
+#error "ADC_PHASE_FRAMES must be a power of two"
+#endif
+
+int32_t ADCphaseCurrent[ADC_PHASE_FRAMES];	//HV current codes around the step
+int32_t ADCphaseVoltage[ADC_PHASE_FRAMES];	//HV voltage codes around the step
+
+bool ADCrangeEnabled = true;
+uint8_t ADCcalibratedChannels = 0;	//channels with an offset or gain calibration, fixed PGA gain
+int32_t ADCrangePeak[3];			//largest code magnitude of the current window
+uint16_t ADCrangeCount = 0;			//frames in the current window
 
 int32_t convert24bitTo32bit(uint8_t *byteArray){
 	int32_t convertedNumber = 0;
@@ -33,22 +77,726 @@ int32_t convert24bitTo32bit(uint8_t *byteArray){
 	return convertedNumber;
 }
 
-double *getADCConvertedData(void){
+/* Function      : ADCunpackFrames
+ *
+ * Description   : Unpacks the channel codes of a batch of frames in the active
+ *               layout into one int32 array per channel (structure of arrays).
+ *
+ * Parameters    : frames first frame of the batch, word aligned in 32-bit words
+ *               stride distance in bytes between consecutive frames, e.g.
+ *               sizeof(sampleTypedef) to unpack straight from the sample queue,
+ *               a multiple of 4 in 32-bit words
+ *               count number of frames
+ *               channels destination array of each channel, count codes each
+ *
+ * Returns       : None
+ */
+void ADCunpackFrames(const uint8_t *frames, uint32_t stride, uint16_t count, int32_t *const channels[3])
+{
+	const ADCframeLayoutTypedef *layout = ADCgetLayout();
+	int32_t *ch0 = channels[0];
+	int32_t *ch1 = channels[1];
+	int32_t *ch2 = channels[2];
+
+	//word aligned frames and stride, whole words
+	if (layout->signExtended) {
+		while (count > 0) {
+			*ch0++ = ADC_FRAME_CODE32(frames, layout, 0);
+			*ch1++ = ADC_FRAME_CODE32(frames, layout, 1);
+			*ch2++ = ADC_FRAME_CODE32(frames, layout, 2);
+			frames += stride;
+			count--;
+		}
+		return;
+	}
+
+	while (count > 0) {
+		*ch0++ = ADC_FRAME_CODE(frames, layout, 0);
+		*ch1++ = ADC_FRAME_CODE(frames, layout, 1);
+		*ch2++ = ADC_FRAME_CODE(frames, layout, 2);
+		frames += stride;
+		count--;
+	}
+}
+
+double *getADCConvertedData(uint8_t *frame){
+	const ADCframeLayoutTypedef *layout = ADCgetLayout();
 	int32_t rawData32bits[3];
 
 	for (uint8_t i=0; i<3; i++){
-		rawData32bits[i] = convert24bitTo32bit(&(ADCrawData[(i*3)+3]));
+		rawData32bits[i] = layout->signExtended ? ADC_FRAME_CODE32(frame, layout, i) : ADC_FRAME_CODE(frame, layout, i);
 
-		ADCconvertedChannels[i] = ((double)rawData32bits[i] * ADC_MAX_RANGE)/(ADCgain[i] * ADC_DEFAULT_MAX_RAW);
+		ADCconvertedChannels[i] = (double)rawData32bits[i] * ADCscale[i];
 	}
 
-	ADCconvertedChannels[SUPPLY_CURRENT_CH] = ADCconvertedChannels[SUPPLY_CURRENT_CH]/SUPPLY_I_SHUNT_RESISTANCE;
-	ADCconvertedChannels[HV_CURRENT_CH] = -1 * ADCconvertedChannels[HV_CURRENT_CH]/SHUNT_RESISTANCE;
-	ADCconvertedChannels[HV_VOLTAGE_CH] = ADCconvertedChannels[HV_VOLTAGE_CH]/VOLTAGE_DIVIDER;
-
 	return (double *)&ADCconvertedChannels;
 }
 
 double getADCSingleChannel(uint8_t channel){
 	return ADCconvertedChannels[channel];
 }
+
+//selects the per channel scale factors for the PGA settings (log2 of the gain), shall be called whenever a gain changes
+void ADCupdateScaleFactors(uint8_t *log2Gain){
+	for (uint8_t i=0; i<3; i++){
+		ADCscaleQ[i] = ADCscaleTable[i][log2Gain[i] & (ADC_GAIN_QTY - 1)];
+		ADCscale[i] = ADCscaleTableDouble[i][log2Gain[i] & (ADC_GAIN_QTY - 1)];
+	}
+}
+
+//converts a frame to micro-units with one 32x64 multiply per channel, no floating point
+int32_t *getADCConvertedFixed(uint8_t *frame){
+	return getADCConvertedFixedLayout(frame, ADCgetLayout());
+}
+
+//getADCConvertedFixed for a frame in a given layout, word aligned in 32-bit words
+int32_t *getADCConvertedFixedLayout(const uint8_t *frame, const ADCframeLayoutTypedef *layout){
+	int32_t rawData32bits;
+
+	if (layout->signExtended){
+		for (uint8_t i=0; i<3; i++){
+			rawData32bits = ADC_FRAME_CODE32(frame, layout, i);
+
+			ADCconvertedFixed[i] = (int32_t)(((int64_t)rawData32bits * ADCscaleQ[i] + (1LL << (ADC_SCALE_SHIFT - 1))) >> ADC_SCALE_SHIFT);
+		}
+		return (int32_t *)&ADCconvertedFixed;
+	}
+
+	for (uint8_t i=0; i<3; i++){
+		rawData32bits = ADC_FRAME_CODE(frame, layout, i);
+
+		ADCconvertedFixed[i] = (int32_t)(((int64_t)rawData32bits * ADCscaleQ[i] + (1LL << (ADC_SCALE_SHIFT - 1))) >> ADC_SCALE_SHIFT);
+	}
+
+	return (int32_t *)&ADCconvertedFixed;
+}
+
+int32_t getADCSingleChannelFixed(uint8_t channel){
+	return ADCconvertedFixed[channel];
+}
+
+//raw code (24-bit units) of a value in micro-units for a scale factor, clamped to the int32 range
+static int32_t ADCcodeFromScale(int32_t value, int64_t scale){
+	int64_t code;
+
+	if (scale == 0){
+		return 0;
+	}
+
+	code = ((int64_t)value * (1LL << ADC_SCALE_SHIFT)) / scale;
+
+	return code > INT32_MAX ? INT32_MAX : (code < -INT32_MAX ? -INT32_MAX : (int32_t)code);
+}
+
+//raw code (24-bit units) of a value in micro-units at the present gain of a channel, the
+//inverse of getADCConvertedFixed. 0 when the channel has no scale factor
+int32_t ADCcodeFromFixed(uint8_t channel, int32_t value){
+	if (channel > 2){
+		return 0;
+	}
+
+	return ADCcodeFromScale(value, ADCscaleQ[channel]);
+}
+
+//ADCcodeFromFixed for a given PGA setting (log2 of the gain) instead of the present one
+int32_t ADCcodeFromFixedGain(uint8_t channel, int32_t value, uint8_t log2Gain){
+	if (channel > 2){
+		return 0;
+	}
+
+	return ADCcodeFromScale(value, ADCscaleTable[channel][log2Gain & (ADC_GAIN_QTY - 1)]);
+}
+
+//micro-units per code of a channel and PGA setting, in Q(ADC_SCALE_SHIFT)
+int64_t ADCgetScale(uint8_t channel, uint8_t log2Gain){
+	return channel > 2 ? 0 : ADCscaleTable[channel][log2Gain & (ADC_GAIN_QTY - 1)];
+}
+
+/* Function      : getADCConvertedFixedTagged
+ *
+ * Description   : Converts a frame to micro-units with the scale factors of the
+ *               gains it was converted with. Frames taken while the filter
+ *               settles after a gain change mix both gains, the previous
+ *               values are held instead.
+ *
+ * Parameters    : frame raw ADC frame
+ *               gainTag ADC_GAIN_TAG stamped in the sample
+ *
+ * Returns       : pointer to the three converted channels
+ */
+int32_t *getADCConvertedFixedTagged(uint8_t *frame, uint16_t gainTag){
+	const ADCframeLayoutTypedef *layout = ADCgetLayout();
+	int32_t rawData32bits;
+	int64_t scale;
+
+	if (gainTag & ADC_GAIN_TAG_SETTLING){
+		return (int32_t *)&ADCconvertedFixed;
+	}
+
+	for (uint8_t i=0; i<3; i++){
+		rawData32bits = layout->signExtended ? ADC_FRAME_CODE32(frame, layout, i) : ADC_FRAME_CODE(frame, layout, i);
+		scale = ADCscaleTable[i][ADC_GAIN_TAG_GAIN(gainTag, i)];
+
+		ADCconvertedCodes[i] = rawData32bits;
+		ADCconvertedFixed[i] = (int32_t)(((int64_t)rawData32bits * scale + (1LL << (ADC_SCALE_SHIFT - 1))) >> ADC_SCALE_SHIFT);
+	}
+	ADCconvertedGainTag = gainTag;
+
+	return (int32_t *)&ADCconvertedFixed;
+}
+
+uint16_t getADCConvertedGainTag(void){
+	return ADCconvertedGainTag;
+}
+
+//raw codes of the values returned by getADCConvertedFixedTagged, held the same way
+const int32_t *getADCConvertedCodes(void){
+	return ADCconvertedCodes;
+}
+
+/* Function      : ADCdecodeStatus
+ *
+ * Description   : Decodes the STATUS word of a frame into the health counters.
+ *               Every flag is added as a 0 or 1, no branches. Frames whose
+ *               first word is a command response count as such and decode
+ *               as a clean STATUS.
+ *
+ * Parameters    : frame raw ADC frame
+ *               response true if the first word is a command response
+ *
+ * Returns       : true if the frame data is suspect (ADC_STATUS_SAMPLE_FAULTS or
+ *               an enabled channel without new data)
+ */
+bool ADCdecodeStatus(const uint8_t *frame, bool response){
+	uint16_t valid = (uint16_t)(response - 1);		//0xFFFF for STATUS, 0 for a response
+	uint16_t status = ((frame[0] << 8) | frame[1]) & valid;
+	uint16_t missing = (~status & ADCgetLayout()->channelMask & valid) != 0;
+
+	ADChealth.statusFrames += valid & 1;
+	ADChealth.responseFrames += response;
+	ADChealth.resets += (status >> STATUS_RESET_SHIFT) & 1;
+	ADChealth.regmapChanges += (status >> STATUS_REG_MAP_SHIFT) & 1;
+	ADChealth.inputCrcErrors += (status >> STATUS_CRC_ERR_SHIFT) & 1;
+	ADChealth.resyncs += (status >> STATUS_F_RESYNC_SHIFT) & 1;
+	ADChealth.drdyMissing += missing;
+
+	return ((status & ADC_STATUS_SAMPLE_FAULTS) != 0) | missing;
+}
+
+const ADChealthTypedef *ADCgetHealth(void){
+	return &ADChealth;
+}
+
+/* Function      : ADCautoRange
+ *
+ * Description   : Auto-ranging PGA, fed with every sample. A channel whose code
+ *               goes above ADC_RANGE_HIGH is stepped down right away; channels
+ *               whose peak stayed below ADC_RANGE_LOW for ADC_RANGE_WINDOW
+ *               frames are stepped up. Samples converted with other gains or
+ *               while the filter settles are ignored. Calibrated channels keep
+ *               the gain of their calibration, OCAL and GCAL only hold for it.
+ *
+ * Parameters    : frame raw ADC frame
+ *               gainTag ADC_GAIN_TAG stamped in the sample
+ *
+ * Returns       : None
+ */
+void ADCautoRange(const uint8_t *frame, uint16_t gainTag){
+	const ADCframeLayoutTypedef *layout = ADCgetLayout();
+	uint8_t channels = ADC_RANGE_CHANNELS & layout->channelMask & ~ADCcalibratedChannels;
+	uint8_t log2Gain[3];
+	int32_t code;
+	bool change = false;
+
+	if (!ADCrangeEnabled || (gainTag & ADC_GAIN_TAG_SETTLING) || gainTag != ADCgetGainTag()){
+		return;
+	}
+
+	for (uint8_t i=0; i<3; i++){
+		log2Gain[i] = ADC_GAIN_TAG_GAIN(gainTag, i);
+
+		if (!(channels & (1 << i))){
+			continue;
+		}
+
+		code = ADC_FRAME_CODE(frame, layout, i);
+		code = code < 0 ? -code : code;
+
+		if (code > ADC_RANGE_HIGH && log2Gain[i] > GAIN_PGA_GAIN_1){
+			log2Gain[i]--;
+			change = true;
+		} else if (code > ADCrangePeak[i]){
+			ADCrangePeak[i] = code;
+		}
+	}
+
+	if (!change && ++ADCrangeCount >= ADC_RANGE_WINDOW){
+		for (uint8_t i=0; i<3; i++){
+			if ((channels & (1 << i)) && ADCrangePeak[i] < ADC_RANGE_LOW && log2Gain[i] < GAIN_PGA_GAIN_128){
+				log2Gain[i]++;
+				change = true;
+			}
+			ADCrangePeak[i] = 0;
+		}
+		ADCrangeCount = 0;
+	}
+
+	if (change){
+		for (uint8_t i=0; i<3; i++){
+			ADCrangePeak[i] = 0;
+		}
+		ADCrangeCount = 0;
+
+		if (ADCsetGain(log2Gain[0], log2Gain[1], log2Gain[2]) != HAL_OK){
+			printf("[adc.c]Error changing the PGA gains.\n\r");
+		}
+	}
+}
+
+void ADCautoRangeEnable(bool enable){
+	ADCrangeEnabled = enable;
+	ADCrangeCount = 0;
+	for (uint8_t i=0; i<3; i++){
+		ADCrangePeak[i] = 0;
+	}
+}
+
+bool ADCautoRangeEnabled(void){
+	return ADCrangeEnabled;
+}
+
+/* Function      : ADCaverageRaw
+ *
+ * Description   : Averages the raw code of a channel over ADC_CAL_FRAMES
+ *               frames taken from the sample queue. Queued frames and the
+ *               first ADC_CAL_SETTLE_FRAMES are discarded, so the average only
+ *               holds frames converted after the last register write.
+ *
+ * Parameters    : channel ADC channel
+ *               average destination of the averaged code
+ *
+ * Returns       : HAL_OK or HAL_TIMEOUT if the frames do not arrive
+ */
+static uint8_t ADCaverageRaw(uint8_t channel, int32_t *average)
+{
+	sampleTypedef *sample;
+	int64_t sum = 0;
+	uint16_t frames = 0;
+	uint16_t settle = ADC_CAL_SETTLE_FRAMES;
+	uint32_t timeout = (ADC_CAL_FRAMES + ADC_CAL_SETTLE_FRAMES) * 1000 / ADCgetProfileInfo(ADCgetProfile())->dataRate + ADC_CAL_TIMEOUT;
+	uint32_t start = HAL_GetTick();
+
+	while (sampleQueuePeek() != NULL) {
+		sampleQueueRelease();
+	}
+
+	while (frames < ADC_CAL_FRAMES) {
+		if (HAL_GetTick() - start > timeout) {
+			return HAL_TIMEOUT;
+		}
+
+		sample = sampleQueuePeek();
+		if (sample == NULL) {
+			continue;
+		}
+
+		if (settle > 0) {
+			settle--;
+		} else {
+			sum += ADC_FRAME_CODE(sample->frame, ADCgetLayout(), channel);
+			frames++;
+		}
+		sampleQueueRelease();
+	}
+
+	*average = (int32_t)((sum + (sum >= 0 ? ADC_CAL_FRAMES/2 : -ADC_CAL_FRAMES/2)) / ADC_CAL_FRAMES);
+
+	return HAL_OK;
+}
+
+//channels whose offset or gain differs from the reset calibration
+static void ADCupdateCalibrated(void)
+{
+	ADCcalibratedChannels = 0;
+	for (uint8_t i=0; i<3; i++){
+		if (ADCcalibration.offset[i] != OCAL_DEFAULT || ADCcalibration.gain[i] != GCAL_DEFAULT){
+			ADCcalibratedChannels |= (1 << i);
+		}
+	}
+}
+
+/* Function      : ADCapplyCalibration
+ *
+ * Description   : Writes the calibration and phase delay of every channel into
+ *               the ADC. Calibrated channels are set back to the PGA gain they
+ *               were calibrated at, the auto-ranging leaves them there.
+ *
+ * Parameters    : None
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+static uint8_t ADCapplyCalibration(void)
+{
+	uint8_t res = HAL_OK;
+	uint8_t log2Gain[3];
+
+	for (uint8_t i=0; i<3; i++){
+		res |= ADCwriteCalibration(i, ADCcalibration.offset[i], ADCcalibration.gain[i]);
+		res |= ADCwritePhase(i, ADCcalibration.phase[i]);
+	}
+
+	ADCupdateCalibrated();
+	for (uint8_t i=0; i<3; i++){
+		log2Gain[i] = (ADCcalibratedChannels & (1 << i)) ? ADCcalibration.log2Gain[i] : ADC_GAIN_TAG_GAIN(ADCgetGainTag(), i);
+	}
+	if (ADC_GAIN_TAG(log2Gain[0], log2Gain[1], log2Gain[2]) != (ADCgetGainTag() & ADC_GAIN_TAG_MASK)){
+		res |= ADCsetGain(log2Gain[0], log2Gain[1], log2Gain[2]);
+	}
+
+	return res == HAL_OK ? HAL_OK : HAL_ERROR;
+}
+
+/* Function      : ADCresetCalibration
+ *
+ * Description   : Sets every channel back to no offset, unity gain and no
+ *               phase delay.
+ *
+ * Parameters    : None
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCresetCalibration(void)
+{
+	ADCcalibration.signature = ADC_CAL_SIGNATURE;
+	for (uint8_t i=0; i<3; i++){
+		ADCcalibration.offset[i] = OCAL_DEFAULT;
+		ADCcalibration.gain[i] = GCAL_DEFAULT;
+		ADCcalibration.phase[i] = 0;
+		ADCcalibration.log2Gain[i] = ADC_GAIN_TAG_GAIN(ADCgetGainTag(), i);
+	}
+
+	return ADCapplyCalibration();
+}
+
+/* Function      : ADCloadCalibration
+ *
+ * Description   : Reads the calibration from the EEPROM parameters area and
+ *               writes it into the ADC. A blank or corrupted record falls back
+ *               to the reset calibration.
+ *
+ * Parameters    : None
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCloadCalibration(void)
+{
+	if (EEPROMgetLogMetaData() == EEPROM_STATUS_COMPLETE) {
+		memcpy(&ADCcalibration, EEPROMextraInfo() + EEPROM_PARAM_CALIBRATION, sizeof(ADCcalibration));
+
+		if (ADCcalibration.signature == ADC_CAL_SIGNATURE &&
+				ADCcalibration.crc == ADCcrc((uint8_t *)&ADCcalibration, offsetof(ADCcalibrationTypedef, crc))) {
+			printf("[adc.c]Calibration loaded.\n\r");
+			return ADCapplyCalibration();
+		}
+	}
+
+	printf("[adc.c]No valid calibration stored, using defaults.\n\r");
+	return ADCresetCalibration();
+}
+
+/* Function      : ADCsaveCalibration
+ *
+ * Description   : Stores the calibration in the EEPROM parameters area.
+ *
+ * Parameters    : None
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCsaveCalibration(void)
+{
+	ADCcalibration.signature = ADC_CAL_SIGNATURE;
+	ADCcalibration.crc = ADCcrc((uint8_t *)&ADCcalibration, offsetof(ADCcalibrationTypedef, crc));
+
+	if (EEPROMwriteParameters((uint8_t *)&ADCcalibration, EEPROM_PARAM_CALIBRATION, sizeof(ADCcalibration)) != EEPROM_STATUS_COMPLETE) {
+		return HAL_ERROR;
+	}
+
+	return HAL_OK;
+}
+
+/* Function      : ADCcalibrateOffset
+ *
+ * Description   : Offset calibration, the channel input shall be held at zero.
+ *               The averaged code measured without calibration becomes the
+ *               channel OCAL, the gain calibration is kept. The PGA gain is
+ *               recorded, the channel stays at it from now on.
+ *
+ * Parameters    : channel ADC channel
+ *
+ * Returns       : HAL_OK, HAL_ERROR or HAL_TIMEOUT
+ */
+uint8_t ADCcalibrateOffset(uint8_t channel)
+{
+	int32_t average;
+	uint8_t res;
+
+	if (channel > 2) {
+		return HAL_ERROR;
+	}
+
+	res = ADCwriteCalibration(channel, OCAL_DEFAULT, GCAL_DEFAULT);
+	if (res == HAL_OK) {
+		res = ADCaverageRaw(channel, &average);
+	}
+
+	if (res == HAL_OK) {
+		ADCcalibration.offset[channel] = average;
+		ADCcalibration.log2Gain[channel] = ADC_GAIN_TAG_GAIN(ADCgetGainTag(), channel);
+		ADCupdateCalibrated();
+		printf("[adc.c]CH%u offset %ld at gain %u.\n\r", channel, average, 1 << ADCcalibration.log2Gain[channel]);
+	}
+
+	if (ADCwriteCalibration(channel, ADCcalibration.offset[channel], ADCcalibration.gain[channel]) != HAL_OK) {
+		res = HAL_ERROR;
+	}
+
+	return res;
+}
+
+/* Function      : ADCcalibrateGain
+ *
+ * Description   : Gain calibration, the channel input shall be held at a known
+ *               reference, away from zero. The offset calibration is applied
+ *               and GCAL is set to the ratio between the code the reference
+ *               should give with the current PGA setting and the measured one.
+ *               The PGA gain is recorded, the channel stays at it from now on.
+ *
+ * Parameters    : channel ADC channel
+ *               reference applied input, in micro-units (uA, uV)
+ *
+ * Returns       : HAL_OK, HAL_ERROR or HAL_TIMEOUT
+ */
+uint8_t ADCcalibrateGain(uint8_t channel, int32_t reference)
+{
+	int32_t average;
+	int64_t expected;
+	int64_t gain = 0;
+	uint8_t res;
+
+	if (channel > 2 || ADCscaleQ[channel] == 0) {
+		return HAL_ERROR;
+	}
+
+	expected = ((int64_t)reference * (1LL << ADC_SCALE_SHIFT)) / ADCscaleQ[channel];
+
+	res = ADCwriteCalibration(channel, ADCcalibration.offset[channel], GCAL_DEFAULT);
+	if (res == HAL_OK) {
+		res = ADCaverageRaw(channel, &average);
+	}
+
+	if (res == HAL_OK) {
+		if (average != 0) {
+			gain = (expected * GCAL_DEFAULT) / average;
+		}
+
+		if (gain <= 0 || gain > GCAL_MAX) {
+			res = HAL_ERROR;
+		} else {
+			ADCcalibration.gain[channel] = (uint32_t)gain;
+			ADCcalibration.log2Gain[channel] = ADC_GAIN_TAG_GAIN(ADCgetGainTag(), channel);
+			ADCupdateCalibrated();
+			printf("[adc.c]CH%u gain 0x%06lX at gain %u.\n\r", channel, ADCcalibration.gain[channel], 1 << ADCcalibration.log2Gain[channel]);
+		}
+	}
+
+	if (ADCwriteCalibration(channel, ADCcalibration.offset[channel], ADCcalibration.gain[channel]) != HAL_OK) {
+		res = HAL_ERROR;
+	}
+
+	return res;
+}
+
+const ADCcalibrationTypedef *ADCgetCalibration(void)
+{
+	return &ADCcalibration;
+}
+
+/* Function      : ADCsetPhase
+ *
+ * Description   : Sets the phase delay of a channel, kept with the
+ *               calibration.
+ *
+ * Parameters    : channel ADC channel
+ *               phase delay in modulator clocks, ADC_PHASE_MIN to ADC_PHASE_MAX
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCsetPhase(uint8_t channel, int16_t phase)
+{
+	if (ADCwritePhase(channel, phase) != HAL_OK) {
+		return HAL_ERROR;
+	}
+
+	ADCcalibration.phase[channel] = phase;
+
+	return HAL_OK;
+}
+
+/* Function      : ADCcaptureStep
+ *
+ * Description   : Waits for a step of the HV current and keeps the
+ *               ADC_PHASE_FRAMES frames around it, ADC_PHASE_PRETRIGGER of
+ *               them before the trigger, in the ADCphase ring buffers.
+ *
+ * Parameters    : oldest returns the ring index of the oldest frame
+ *
+ * Returns       : HAL_OK or HAL_TIMEOUT if no step is seen
+ */
+static uint8_t ADCcaptureStep(uint32_t *oldest)
+{
+	sampleTypedef *sample;
+	uint32_t frames = 0;
+	uint32_t remaining = 0;
+	uint16_t settle = ADC_CAL_SETTLE_FRAMES;
+	uint32_t start = HAL_GetTick();
+	uint32_t index;
+	int32_t change;
+
+	while (sampleQueuePeek() != NULL) {
+		sampleQueueRelease();
+	}
+
+	while (true) {
+		if (HAL_GetTick() - start > ADC_PHASE_TIMEOUT) {
+			return HAL_TIMEOUT;
+		}
+
+		sample = sampleQueuePeek();
+		if (sample == NULL) {
+			continue;
+		}
+
+		if (settle > 0) {
+			settle--;
+			sampleQueueRelease();
+			continue;
+		}
+
+		index = frames & (ADC_PHASE_FRAMES - 1);
+		ADCphaseCurrent[index] = ADC_FRAME_CODE(sample->frame, ADCgetLayout(), HV_CURRENT_CH);
+		ADCphaseVoltage[index] = ADC_FRAME_CODE(sample->frame, ADCgetLayout(), HV_VOLTAGE_CH);
+		sampleQueueRelease();
+		frames++;
+
+		if (remaining > 0) {
+			if (--remaining == 0) {
+				break;
+			}
+		} else if (frames > ADC_PHASE_PRETRIGGER) {
+			change = ADCphaseCurrent[index] - ADCphaseCurrent[(index - ADC_PHASE_STEP_SPAN) & (ADC_PHASE_FRAMES - 1)];
+			if (change > ADC_PHASE_STEP_MIN || change < -ADC_PHASE_STEP_MIN) {
+				remaining = ADC_PHASE_FRAMES - ADC_PHASE_PRETRIGGER;
+			}
+		}
+	}
+
+	*oldest = frames & (ADC_PHASE_FRAMES - 1);
+
+	return HAL_OK;
+}
+
+/* Function      : ADCmeasurePhase
+ *
+ * Description   : Phase alignment measurement. With the HV current and
+ *               voltage phase delays cleared, a current step shall be applied
+ *               (e.g. a load switched on). Both channels see the step at the
+ *               same instant, so the delay between their edges is the skew of
+ *               the front ends. The edge time of each channel is the centroid
+ *               of its first difference around the largest current change.
+ *               The channel that leads is then delayed by the measured skew.
+ *
+ * Parameters    : delay returns the delay of the voltage edge after the current
+ *               edge, in modulator clocks
+ *
+ * Returns       : HAL_OK, HAL_ERROR or HAL_TIMEOUT
+ */
+uint8_t ADCmeasurePhase(int32_t *delay)
+{
+	const uint8_t channel[2] = {HV_CURRENT_CH, HV_VOLTAGE_CH};
+	int16_t phase[2];
+	int64_t sum[2] = {0, 0};
+	int64_t moment[2] = {0, 0};
+	int32_t diff, peak = 0;
+	uint32_t edge = 1, first, last, oldest = 0;
+	int64_t skew;
+	uint8_t res = HAL_OK;
+
+	for (uint8_t i = 0; i < 2; i++) {
+		phase[i] = ADCcalibration.phase[channel[i]];
+		res |= ADCwritePhase(channel[i], 0);
+	}
+
+	if (res == HAL_OK) {
+		res = ADCcaptureStep(&oldest);
+	} else {
+		res = HAL_ERROR;
+	}
+
+	if (res == HAL_OK) {
+		for (uint32_t k = 1; k < ADC_PHASE_FRAMES; k++) {
+			diff = ADC_PHASE_AT(ADCphaseCurrent, oldest, k) - ADC_PHASE_AT(ADCphaseCurrent, oldest, k-1);
+			diff = diff < 0 ? -diff : diff;
+			if (diff > peak) {
+				peak = diff;
+				edge = k;
+			}
+		}
+
+		first = edge > ADC_PHASE_WINDOW ? edge - ADC_PHASE_WINDOW : 1;
+		last = edge + ADC_PHASE_WINDOW < ADC_PHASE_FRAMES ? edge + ADC_PHASE_WINDOW : ADC_PHASE_FRAMES - 1;
+
+		for (uint32_t k = first; k <= last; k++) {
+			diff = ADC_PHASE_AT(ADCphaseCurrent, oldest, k) - ADC_PHASE_AT(ADCphaseCurrent, oldest, k-1);
+			diff = diff < 0 ? -diff : diff;
+			sum[0] += diff;
+			moment[0] += (int64_t)diff * (k - first);
+
+			diff = ADC_PHASE_AT(ADCphaseVoltage, oldest, k) - ADC_PHASE_AT(ADCphaseVoltage, oldest, k-1);
+			diff = diff < 0 ? -diff : diff;
+			sum[1] += diff;
+			moment[1] += (int64_t)diff * (k - first);
+		}
+
+		if (sum[1] < ADC_PHASE_EDGE_MIN) {
+			printf("[adc.c]No voltage edge at the current step.\n\r");
+			res = HAL_ERROR;
+		}
+	}
+
+	if (res == HAL_OK) {
+		//edge skew in 1/2^ADC_PHASE_FRAC_BITS frame, then in modulator clocks
+		skew = (moment[1] << ADC_PHASE_FRAC_BITS) / sum[1] - (moment[0] << ADC_PHASE_FRAC_BITS) / sum[0];
+		skew = skew * ADCgetProfileInfo(ADCgetProfile())->osr;
+		skew = (skew + (skew >= 0 ? 1 : -1) * (1 << (ADC_PHASE_FRAC_BITS - 1))) / (1 << ADC_PHASE_FRAC_BITS);
+		*delay = (int32_t)skew;
+
+		skew = skew < 0 ? -skew : skew;
+		if (skew > ADC_PHASE_MAX) {
+			printf("[adc.c]Phase skew %ld out of range.\n\r", *delay);
+			skew = ADC_PHASE_MAX;
+		}
+
+		//a late voltage edge delays the current, a late current edge delays the voltage
+		phase[0] = *delay > 0 ? (int16_t)skew : 0;
+		phase[1] = *delay < 0 ? (int16_t)skew : 0;
+		printf("[adc.c]Phase skew %ld clocks, current %d, voltage %d.\n\r", *delay, phase[0], phase[1]);
+	}
+
+	for (uint8_t i = 0; i < 2; i++) {
+		if (ADCsetPhase(channel[i], phase[i]) != HAL_OK) {
+			res = HAL_ERROR;
+		}
+	}
+
+	return res;
+}
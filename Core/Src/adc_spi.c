@@ -11,12 +11,82 @@
   */
 
 #include "adc_spi.h"
-#include <math.h>
+#include "queue.h"
+#include "adc.h"
+#include "timebase.h"
+#include "stdbool.h"
+#include <string.h>
+
+#define ADC_PROFILE_RATE(period, osr)	(ADC_CLKIN_TIMER_FREQ / ((period) + 1) / 2 / (osr))
+
+//MODE register configuration, the word length comes from the frame layout
+#define ADC_MODE_CONFIG		(MODE_REG_CRC_EN_ON | MODE_RX_CRC_EN_ON | ADC_CRC_TYPE | MODE_RESET_CLEAR | \
+							MODE_TIMEOUT | MODE_DRDY_SEL | MODE_DRDY_HIZ | MODE_DRDY_FMT_PULSE)
+
+const ADCprofileTypedef ADCprofiles[ADC_PROFILE_QTY] = {
+	[ADC_PROFILE_PARKED] = { "parked", CLOCK_OSR_16256, 16256, CLOCK_PWR_VLP, ADC_CLKIN_PERIOD_VLP,
+			ADC_PROFILE_RATE(ADC_CLKIN_PERIOD_VLP, 16256) },
+	[ADC_PROFILE_PRECISION] = { "precision", CLOCK_OSR_16256, 16256, CLOCK_PWR_HR, ADC_CLKIN_PERIOD_HR,
+			ADC_PROFILE_RATE(ADC_CLKIN_PERIOD_HR, 16256) },
+	[ADC_PROFILE_TRANSIENT] = { "transient", CLOCK_OSR_1024, 1024, CLOCK_PWR_HR, ADC_CLKIN_PERIOD_HR,
+			ADC_PROFILE_RATE(ADC_CLKIN_PERIOD_HR, 1024) },
+	[ADC_PROFILE_BURST] = { "burst", CLOCK_OSR_128, 128, CLOCK_PWR_HR, ADC_CLKIN_PERIOD_HR,
+			ADC_PROFILE_RATE(ADC_CLKIN_PERIOD_HR, 128) },
+};
+
+extern TIM_HandleTypeDef htim16;
 
 SPI_HandleTypeDef * ADC_SPI = NULL;
-uint8_t ADCrawData[ADC_WORD_SIZE/8 * 5];
-uint8_t ADCdummy[ADC_WORD_SIZE/8 * 5];
-uint8_t ADCgain[3];
+ADCprofileId ADCprofile = ADC_DEFAULT_PROFILE;
+uint8_t ADCrawData[ADC_FRAME_SIZE] __ALIGNED(4);
+uint8_t ADCdummy[ADC_RESPONSE_MAX_SIZE] __ALIGNED(4);
+ADCframeLayoutTypedef ADClayout;
+uint8_t ADClog2Gain[3];
+
+//gain tag stamped in the captured samples, switched when the GAIN write reaches the ADC
+volatile uint16_t ADCgainTag = 0;
+volatile uint16_t ADCgainTagNext = 0;	//gains of the GAIN write in progress
+volatile bool ADCgainWriting = false;
+volatile uint8_t ADCgainSettle = 0;		//frames left until the filter settles
+
+//register shadow cache, 16-bit register contents known to be in the ADC
+uint16_t ADCregCache[ADC_CACHE_SIZE];
+bool ADCregCacheValid[ADC_CACHE_SIZE];
+uint16_t ADCregmapCrc = 0;				//REGMAP_CRC read after the last full verification
+bool ADCregmapCrcValid = false;
+
+//command sent with a captured frame, its response replaces STATUS in the following frame
+uint8_t ADCcommandFrame[ADC_FRAME_SIZE] __ALIGNED(4);
+volatile bool ADCcommandPending = false;	//posted, waiting for the next frame
+volatile bool ADCcommandInFlight = false;	//being sent with the frame in flight
+volatile bool ADCcommandSent = false;		//sent, the frame in flight carries the response
+volatile bool ADCresponseReady = false;
+volatile bool ADCresponseValid = false;
+volatile uint16_t ADCresponse = 0;
+
+//frames captured by DMA are written straight into the sample queue slot
+sampleTypedef *ADCframeSlot = NULL;		//queue slot the DMA is writing to
+volatile bool ADCframeInFlight = false;
+volatile bool ADCframePending = false;
+volatile uint32_t ADCframeTimestamp = 0;
+volatile uint32_t ADCframeSequence = 0;
+volatile uint32_t ADCsequence = 0;		//sequence number of the next DRDY
+volatile uint32_t ADCdropped = 0;
+volatile uint32_t ADCcrcErrorCount = 0;
+
+//DRDY watchdog, the sequence number stops moving when the ADC stalls
+uint32_t ADCwatchdogSequence = 0;		//sequence seen by the last check
+uint32_t ADCwatchdogStamp = 0;			//time it was first seen, us
+bool ADCstalled = false;				//recovery failed, retried after the backoff
+uint32_t ADCstallStart = 0;				//time of the last frame before the outage, us
+volatile bool ADCrecoveryRequested = false;
+ADCoutageTypedef ADCoutage = {0};
+
+//standby in current detect mode, the configuration to return to
+bool ADCstandby = false;
+ADCprofileId ADCstandbyProfile = ADC_DEFAULT_PROFILE;
+uint8_t ADCstandbyMask = ADC_CHANNEL_MASK_ALL;
+uint32_t ADCstandbyCfg = CFG_DEFAULT;
 
 void ADC_CS_ENABLE(void)
 {
@@ -28,122 +98,1423 @@ void ADC_CS_DISABLE(void)
 	HAL_GPIO_WritePin(ADC_CS_GPIO_Port, ADC_CS_Pin, GPIO_PIN_SET);
 }
 
+/* Function      : ADCcrcInit
+ *
+ * Description   : Configures the CRC peripheral for the ADC CRC: 16-bit
+ *               polynomial of the ADC CRC type, 0xFFFF seed, no reflection.
+ *
+ * Parameters    : None
+ *
+ * Returns       : None
+ */
+static void ADCcrcInit(void)
+{
+	__HAL_RCC_CRC_CLK_ENABLE();
+
+	CRC->POL = ADC_CRC_POLY;
+	CRC->INIT = ADC_CRC_INIT;
+	CRC->CR = CRC_CR_POLYSIZE_0 | CRC_CR_RESET;
+}
+
+/* Function      : ADCcrc
+ *
+ * Description   : Computes the ADC CRC of a byte sequence on the CRC peripheral.
+ *               Whole words are fed 32 bits at a time. The peripheral is shared
+ *               by the frame checks of the DMA interrupt and the commands and
+ *               calibration of the main loop, so interrupts are masked while
+ *               it is in use (a few words, under a microsecond).
+ *
+ * Parameters    : data bytes in transmission order
+ *               size number of bytes
+ *
+ * Returns       : 16-bit CRC
+ */
+uint16_t ADCcrc(const uint8_t *data, uint8_t size)
+{
+	uint32_t primask;
+	uint16_t crc;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	CRC->CR |= CRC_CR_RESET;
+
+	while (size >= 4) {
+		CRC->DR = __REV(__UNALIGNED_UINT32_READ(data));
+		data += 4;
+		size -= 4;
+	}
+
+	while (size > 0) {
+		*(__IO uint8_t *)&CRC->DR = *data;
+		data++;
+		size--;
+	}
+
+	crc = (uint16_t)CRC->DR;
+	__set_PRIMASK(primask);
+
+	return crc;
+}
+
+//checks the CRC word at crcOffset against the CRC of the words before it
+static bool ADCcrcWordValid(const uint8_t *data, uint8_t crcOffset)
+{
+	uint16_t crc = ADCcrc(data, crcOffset);
+
+	return (data[crcOffset] == (uint8_t)(crc >> 8)) && (data[crcOffset + 1] == (uint8_t)crc);
+}
+
+/* Function      : ADCframeCrcValid
+ *
+ * Description   : Checks the CRC word of an output frame against the CRC of the
+ *               STATUS and channel words. Frames cut before the CRC word
+ *               cannot be checked and are taken as valid.
+ *
+ * Parameters    : frame raw ADC frame in the active layout
+ *
+ * Returns       : true if the CRC matches
+ */
+bool ADCframeCrcValid(const uint8_t *frame)
+{
+	if (ADClayout.crcOffset == 0) {
+		return true;
+	}
+
+	return ADCcrcWordValid(frame, ADClayout.crcOffset);
+}
+
+/* Function      : ADCcomputeLayout
+ *
+ * Description   : Computes the frame layout for a channel mask and word
+ *               length. Does not write the ADC.
+ *
+ * Parameters    : layout destination
+ *               channelMask enabled channels, bit n for CHn
+ *               wlength MODE WLENGTH field
+ *
+ * Returns       : None
+ */
+void ADCcomputeLayout(ADCframeLayoutTypedef *layout, uint8_t channelMask, uint32_t wlength)
+{
+	uint8_t words;
+	uint8_t last = 0;
+
+	layout->modeWlength = wlength;
+	layout->channelMask = channelMask & ADC_CHANNEL_MASK_ALL;
+	layout->wordBytes = (wlength == MODE_WLENGTH_16) ? 2 : ((wlength == MODE_WLENGTH_24) ? 3 : 4);
+	layout->signExtended = (wlength == MODE_WLENGTH_32_M);
+
+	//16-bit words keep the top of the code, 24 and 32-bit zero padded words the whole code,
+	//sign-extended words are the code itself
+	layout->codeShift = layout->signExtended ? 0 : 8;
+	for (uint8_t i = 0; i < 3; i++) {
+		layout->channelOffset[i] = layout->wordBytes * (i + 1);
+		if (layout->channelMask & (1 << i)) {
+			layout->codeMask[i] = layout->signExtended ? 0xFFFFFFFF : ((layout->wordBytes == 2) ? 0xFFFF0000 : 0xFFFFFF00);
+			last = i;
+		} else {
+			layout->codeMask[i] = 0;
+		}
+	}
+
+	//STATUS, the channels up to the last enabled one and, when that is CH2, the CRC
+	words = (last == 2) ? ADC_FRAME_WORDS : last + 2;
+	words = words < ADC_FRAME_MIN_WORDS ? ADC_FRAME_MIN_WORDS : words;
+	layout->frameSize = layout->wordBytes * words;
+	layout->crcOffset = (words == ADC_FRAME_WORDS) ? layout->wordBytes * (ADC_FRAME_WORDS - 1) : 0;
+}
+
+/* Function      : ADCupdateLayout
+ *
+ * Description   : Makes a layout the active one and builds the NULL command
+ *               with its input CRC in its word length. Does not write the ADC.
+ *
+ * Parameters    : channelMask enabled channels, bit n for CHn
+ *               wlength MODE WLENGTH field
+ *
+ * Returns       : None
+ */
+static void ADCupdateLayout(uint8_t channelMask, uint32_t wlength)
+{
+	uint16_t crc;
+
+	ADCcomputeLayout(&ADClayout, channelMask, wlength);
+
+	//the NULL command carries its input CRC in the next word
+	for (uint16_t i = 0; i < sizeof(ADCdummy); i++) {
+		ADCdummy[i] = DUMMY;
+	}
+	crc = ADCcrc(ADCdummy, ADClayout.wordBytes);
+	ADCdummy[ADClayout.wordBytes] = crc >> 8;
+	ADCdummy[ADClayout.wordBytes + 1] = crc;
+}
+
+const ADCframeLayoutTypedef *ADCgetLayout(void)
+{
+	return &ADClayout;
+}
+
+uint32_t ADCcrcErrors(void)
+{
+	return ADCcrcErrorCount;
+}
+
 uint8_t *ADCrawChannelsPointer(void){
 	return (uint8_t *)&ADCrawData;
 }
 
-uint8_t *ADCrawChannels(void) {
+/* Function      : ADCstartFrameDMA
+ *
+ * Description   : Starts the DMA read of the current ADC frame into the next
+ *               sample queue slot. The caller must own the SPI bus through
+ *               spiBusTryLockFromISR, the bus is released when the transfer
+ *               completes or could not be started.
+ *
+ * Parameters    : None
+ *
+ * Returns       : None
+ */
+static void ADCstartFrameDMA(void)
+{
+	sampleTypedef *slot;
+	uint8_t *command = ADCdummy;
 
-	checkAndConfigureSpiMode(ADC_SPI, ADC_CPOL, ADC_CPHA);
+	ADCframePending = false;
 
-	while (ADC_SPI->State != HAL_SPI_STATE_READY) {
-		HAL_Delay(1);
+	//queue full, the logging loop is late and the frame is lost (counted by the queue)
+	slot = sampleQueueProducerSlot();
+	if (slot == NULL) {
+		spiBusUnlockFromISR();
+		return;
+	}
+
+	slot->timestamp = ADCframeTimestamp;
+	slot->sequence = ADCframeSequence;
+	ADCframeSlot = slot;
+
+	checkAndConfigureSpiModeFromISR(ADC_SPI, ADC_CPOL, ADC_CPHA);
+
+	if (ADCcommandPending && !ADCcommandSent) {
+		command = ADCcommandFrame;
+		ADCcommandInFlight = true;
 	}
 
+	ADCframeInFlight = true;
 	ADC_CS_ENABLE();
 
-	while (HAL_SPI_TransmitReceive(ADC_SPI, (uint8_t *)&ADCdummy, (uint8_t *)&ADCrawData, (ADC_WORD_SIZE/8) * 5, ADC_TIMEOUT) == HAL_BUSY) {
+	if (HAL_SPI_TransmitReceive_DMA(ADC_SPI, command, slot->frame, ADClayout.frameSize) != HAL_OK) {
+		ADC_CS_DISABLE();
+		ADCframeInFlight = false;
+		ADCcommandInFlight = false;
+		ADCdropped++;
+		spiBusUnlockFromISR();
+	}
+}
+
+/* Function      : ADCbusReleased
+ *
+ * Description   : SPI bus release hook. Reads the frame whose DRDY arrived
+ *               while the main loop was using the bus. It runs in the main
+ *               loop, so interrupts are masked for the frame start to be
+ *               atomic with respect to the DRDY interrupt that also starts it.
+ *
+ * Parameters    : None
+ *
+ * Returns       : None
+ */
+static void ADCbusReleased(void)
+{
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (ADCframePending && !ADCframeInFlight && spiBusTryLockFromISR()) {
+		ADCstartFrameDMA();
+	}
+
+	__set_PRIMASK(primask);
+}
+
+/* Function      : ADCcaptureFrame
+ *
+ * Description   : Called from the DRDY interrupt. Starts the frame read right
+ *               away when the SPI bus is free, otherwise defers it to the
+ *               moment the bus is released.
+ *
+ * Parameters    : timestamp time at which DRDY was seen, in microseconds
+ *
+ * Returns       : None
+ */
+void ADCcaptureFrame(uint32_t timestamp)
+{
+	uint32_t sequence = ADCnextSequence();
+
+	if (ADC_SPI == NULL) {
+		return;
+	}
+
+	ADCframeTimestamp = timestamp;
+	ADCframeSequence = sequence;
+
+	//previous frame still being transferred
+	if (ADCframeInFlight) {
+		ADCdropped++;
+		return;
+	}
+
+	if (spiBusTryLockFromISR()) {
+		ADCstartFrameDMA();
+	} else {
+		ADCframePending = true;
+	}
+}
+
+/* Function      : ADCcaptureComplete
+ *
+ * Description   : Called from the SPI TxRx complete callback. Publishes the
+ *               sample to the queue and releases the bus. Frames with a bad
+ *               CRC are counted and dropped.
+ *
+ * Parameters    : hspi SPI handle that completed the transfer
+ *
+ * Returns       : None
+ */
+void ADCcaptureComplete(SPI_HandleTypeDef * hspi)
+{
+	if (hspi != ADC_SPI || !ADCframeInFlight) {
+		return;
+	}
+
+	bool crcValid;
+
+	ADC_CS_DISABLE();
+
+	crcValid = ADCframeCrcValid(ADCframeSlot->frame);
+	ADCframeSlot->gainTag = ADCframeGainTag();
+
+	//response to the command sent with the previous frame
+	ADCframeSlot->response = ADCcommandSent;
+	if (ADCcommandSent) {
+		ADCresponse = (ADCframeSlot->frame[0] << 8) | ADCframeSlot->frame[1];
+		ADCresponseValid = crcValid;
+		ADCcommandSent = false;
+		ADCresponseReady = true;
+	}
+
+	if (ADCcommandInFlight) {
+		ADCcommandInFlight = false;
+		ADCcommandPending = false;
+		ADCcommandSent = true;
+
+		//the frames converted from now on use the new gains
+		if (ADCgainWriting) {
+			ADCgainTag = ADCgainTagNext | ADC_GAIN_TAG_SETTLING;
+			ADCgainSettle = ADC_GAIN_SETTLE_FRAMES;
+		}
+	}
+
+	if (crcValid) {
+		sampleQueueCommit();
+	} else {
+		ADCcrcErrorCount++;
+	}
+
+	ADCframeInFlight = false;
+	spiBusUnlockFromISR();
+}
+
+/* Function      : ADCcaptureError
+ *
+ * Description   : Called from the SPI error callback. Drops the frame being
+ *               transferred and releases the bus.
+ *
+ * Parameters    : hspi SPI handle that reported the error
+ *
+ * Returns       : None
+ */
+void ADCcaptureError(SPI_HandleTypeDef * hspi)
+{
+	if (hspi != ADC_SPI || !ADCframeInFlight) {
+		return;
+	}
+
+	ADC_CS_DISABLE();
+
+	//the command may not have reached the ADC, its response is lost
+	if (ADCcommandInFlight || ADCcommandSent) {
+		ADCcommandInFlight = false;
+		ADCcommandPending = false;
+		ADCcommandSent = false;
+		ADCresponseValid = false;
+		ADCresponseReady = true;
+	}
+
+	ADCframeInFlight = false;
+	ADCdropped++;
+	spiBusUnlockFromISR();
+}
+
+/* Function      : ADCnextSequence
+ *
+ * Description   : Numbers a conversion. Called once per DRDY, whether the
+ *               frame is read or not, so the frames that never reach the
+ *               logging loop show up as gaps in the sequence.
+ *
+ * Parameters    : None
+ *
+ * Returns       : sequence number of the frame
+ */
+uint32_t ADCnextSequence(void)
+{
+	return ADCsequence++;
+}
+
+//number of DRDY seen since power up, sequence number of the next frame
+uint32_t ADCsequenceCount(void)
+{
+	return ADCsequence;
+}
+
+uint32_t ADCframesDropped(void)
+{
+	return ADCdropped;
+}
+
+/* Function      : ADCsuspendCapture
+ *
+ * Description   : Stops the DRDY interrupt and waits for the frame in flight
+ *               so blocking register accesses can use the bus.
+ *
+ * Parameters    : None
+ *
+ * Returns       : true if the capture was running and must be resumed
+ */
+static bool ADCsuspendCapture(void)
+{
+	bool wasRunning = (NVIC_GetEnableIRQ(ADC_DRDY_EXTI_IRQn) != 0);
+
+	uint32_t start = HAL_GetTick();
+
+	HAL_NVIC_DisableIRQ(ADC_DRDY_EXTI_IRQn);
+
+	while (ADCframeInFlight) {
+		//the transfer never completed, aborted as a failed one
+		if (HAL_GetTick() - start > ADC_TIMEOUT) {
+			HAL_SPI_Abort(ADC_SPI);
+			ADCcaptureError(ADC_SPI);
+		}
+	}
+
+	ADCframePending = false;
+
+	return wasRunning;
+}
+
+/* Function      : ADCresumeCapture
+ *
+ * Description   : Re-enables the DRDY interrupt discarding the edges seen
+ *               while the capture was suspended.
+ *
+ * Parameters    : wasRunning value returned by ADCsuspendCapture
+ *
+ * Returns       : None
+ */
+static void ADCresumeCapture(bool wasRunning)
+{
+	if (!wasRunning) {
+		return;
+	}
+
+	__HAL_GPIO_EXTI_CLEAR_IT(ADC_DRDY_Pin);
+	HAL_NVIC_ClearPendingIRQ(ADC_DRDY_EXTI_IRQn);
+	HAL_NVIC_EnableIRQ(ADC_DRDY_EXTI_IRQn);
+}
+
+//timeout of a wait for the next DRDY, in ms
+static uint32_t ADCframeTimeout(void)
+{
+	return ADC_COMMAND_FRAMES * 1000 / ADCprofiles[ADCprofile].dataRate + ADC_TIMEOUT;
+}
+
+/* Function      : ADCwaitDrdy
+ *
+ * Description   : Waits for DRDY to go low, bounded by a few data periods so a
+ *               stalled ADC does not hang the caller.
+ *
+ * Parameters    : None
+ *
+ * Returns       : HAL_OK or HAL_TIMEOUT
+ */
+static uint8_t ADCwaitDrdy(void)
+{
+	uint32_t timeout = ADCframeTimeout();
+	uint32_t start = HAL_GetTick();
+
+	while (HAL_GPIO_ReadPin(ADC_DRDY_GPIO_Port, ADC_DRDY_Pin) == GPIO_PIN_SET) {
+		if (HAL_GetTick() - start > timeout) {
+			return HAL_TIMEOUT;
+		}
+	}
+
+	return HAL_OK;
+}
+
+/* Function      : ADCframeTransfer
+ *
+ * Description   : Blocking frame transfer with CS, waiting at most ADC_TIMEOUT
+ *               for the SPI to be free.
+ *
+ * Parameters    : tx bytes sent
+ *               rx destination of the bytes received, NULL to discard them
+ *               size number of bytes
+ *
+ * Returns       : HAL status of the transfer, HAL_TIMEOUT if the SPI stayed busy
+ */
+static uint8_t ADCframeTransfer(uint8_t *tx, uint8_t *rx, uint16_t size)
+{
+	HAL_StatusTypeDef res = HAL_TIMEOUT;
+	uint32_t start = HAL_GetTick();
+
+	ADC_CS_ENABLE();
+
+	while (ADC_SPI->State != HAL_SPI_STATE_READY && HAL_GetTick() - start <= ADC_TIMEOUT) {
 		HAL_Delay(1);
 	}
 
+	do {
+		res = (rx == NULL) ? HAL_SPI_Transmit(ADC_SPI, tx, size, ADC_TIMEOUT) : HAL_SPI_TransmitReceive(ADC_SPI, tx, rx, size, ADC_TIMEOUT);
+	} while (res == HAL_BUSY && HAL_GetTick() - start <= ADC_TIMEOUT);
+
 	ADC_CS_DISABLE();
 
+	return (res == HAL_BUSY) ? HAL_TIMEOUT : res;
+}
+
+uint8_t *ADCrawChannels(void) {
+
+	checkAndConfigureSpiMode(ADC_SPI, ADC_CPOL, ADC_CPHA);
+
+	if (ADCframeTransfer(ADCdummy, ADCrawData, ADClayout.frameSize) != HAL_OK) {
+		return NULL;
+	}
+
+	if (!ADCframeCrcValid(ADCrawData)) {
+		ADCcrcErrorCount++;
+		return NULL;
+	}
+
 	return (uint8_t *)&ADCrawData;
 }
 
-uint8_t ADCwriteReg(uint8_t reg, uint32_t data)
+/* Function      : ADCbuildCommand
+ *
+ * Description   : Fills a command frame: command word, data words and input
+ *               CRC word in the active word length, padded with DUMMY up to
+ *               the frame size.
+ *
+ * Parameters    : frame destination, ADC_FRAME_SIZE bytes
+ *               command 16-bit command
+ *               data 16-bit data words
+ *               count number of data words
+ *
+ * Returns       : None
+ */
+static void ADCbuildCommand(uint8_t *frame, uint16_t command, const uint16_t *data, uint8_t count)
 {
+	uint8_t pos = 0;
+	uint16_t crc;
+
+	//16-bit command and data words, zero padded to the word length
+	memset(frame, 0, ADClayout.wordBytes * (count + 2));
 
-  // Make command and expected response word using syntax found in data sheet
-  uint8_t commandWord[ADC_WORD_SIZE/8 * 5];
-  uint8_t responseWord[ADC_WORD_SIZE/8 * 5];
-  uint8_t responseArr[ADC_WORD_SIZE/8 * 5];
+	frame[pos] = command >> 8;
+	frame[pos + 1] = command;
+	pos += ADClayout.wordBytes;
 
-	commandWord[0] = (WREG >> 8) + (reg >> 1);
-	commandWord[1] = reg << 7;
-	commandWord[2] = 0;
-	commandWord[3] = data >> 16;
-	commandWord[4] = data >> 8;
-	commandWord[5] = data;
+	for (uint8_t i = 0; i < count; i++) {
+		frame[pos] = data[i] >> 8;
+		frame[pos + 1] = data[i];
+		pos += ADClayout.wordBytes;
+	}
+
+	//input CRC of the command and data words, checked by the ADC when MODE_RX_CRC_EN_ON is set
+	crc = ADCcrc(frame, pos);
+	frame[pos] = crc >> 8;
+	frame[pos + 1] = crc;
+	pos += ADClayout.wordBytes;
 
 	//filling the remaining spots in the command being sent with DUMMY so the ADC Tx buffer is cleared when the command is sent
-	for (uint8_t i = 6; i < ADC_WORD_SIZE/8 * 5; i++) {
-		commandWord[i] = DUMMY;
+	while (pos < ADC_FRAME_SIZE) {
+		frame[pos++] = DUMMY;
 	}
+}
 
-  responseWord[0] = (WREG_RES >> 8) + (reg >> 1);
-  responseWord[1] = reg << 7;
-  responseWord[2] = 0;
+/* Function      : ADCtransaction
+ *
+ * Description   : Blocking command: suspends the capture, sends the command on
+ *               a DRDY and reads the response on the following one. Whole
+ *               frames of the active word length are used, CRC included.
+ *
+ * Parameters    : command command frame, ADC_FRAME_SIZE bytes
+ *               response destination of the response
+ *               size response size in bytes, up to ADC_RESPONSE_MAX_SIZE
+ *
+ * Returns       : HAL status of the response read, HAL_TIMEOUT if DRDY or the
+ *               SPI did not come
+ */
+static uint8_t ADCtransaction(uint8_t *command, uint8_t *response, uint8_t size)
+{
+	uint8_t res;
+	uint8_t frameSize = ADClayout.wordBytes * ADC_FRAME_WORDS;
+
+	//the register access is done in blocking mode, frames are not captured meanwhile
+	bool captureRunning = ADCsuspendCapture();
+	spiBusLock();
 
     //makes sure SPI is configured for CPOL = 0 and CPHA = 1
   	checkAndConfigureSpiMode(ADC_SPI, ADC_CPOL, ADC_CPHA);
 
 	//clear the ADC SPI buffer
-	ADC_CS_ENABLE();
+	res = ADCframeTransfer(ADCdummy, NULL, frameSize);
 
-	while (ADC_SPI->State != HAL_SPI_STATE_READY) {
-		HAL_Delay(1);
+	if (res == HAL_OK && HAL_GPIO_ReadPin(ADC_DRDY_GPIO_Port, ADC_DRDY_Pin) == GPIO_PIN_RESET) {
+		res = ADCframeTransfer(ADCdummy, NULL, frameSize);
 	}
 
-	HAL_SPI_Transmit(ADC_SPI, ADCdummy, ADC_WORD_SIZE/8 * 5, ADC_TIMEOUT);
+	if (res == HAL_OK && (res = ADCwaitDrdy()) == HAL_OK) {
+		res = ADCframeTransfer(command, NULL, frameSize);
+	}
 
-	ADC_CS_DISABLE();
+	// Get response
+	if (res == HAL_OK && (res = ADCwaitDrdy()) == HAL_OK) {
+		res = ADCframeTransfer(ADCdummy, response, size);
+	}
 
-	if (HAL_GPIO_ReadPin(ADC_DRDY_GPIO_Port, ADC_DRDY_Pin) == GPIO_PIN_RESET) {
-		ADC_CS_ENABLE();
+	spiBusUnlock();
+	ADCresumeCapture(captureRunning);
+
+	return res;
+}
 
-		while (ADC_SPI->State != HAL_SPI_STATE_READY) {
-			HAL_Delay(1);
+//true when frames are being captured, commands then go with the captured frames
+static bool ADCcaptureRunning(void)
+{
+#if ADC_CAPTURE_DMA
+	return (NVIC_GetEnableIRQ(ADC_DRDY_EXTI_IRQn) != 0);
+#else
+	return false;
+#endif
+}
+
+/* Function      : ADCframeCommand
+ *
+ * Description   : Sends the command prepared in ADCcommandFrame in place of the
+ *               NULL command of the next captured frame and waits for the
+ *               response, which replaces STATUS in the frame after it.
+ *
+ * Parameters    : response destination of the 16-bit response word
+ *
+ * Returns       : HAL_OK, HAL_ERROR (bad frame CRC) or HAL_TIMEOUT
+ */
+static uint8_t ADCframeCommand(uint16_t *response)
+{
+	uint32_t timeout = ADCframeTimeout();
+	uint32_t start = HAL_GetTick();
+	uint32_t primask;
+
+	ADCresponseReady = false;
+	__DMB();
+	ADCcommandPending = true;
+
+	while (!ADCresponseReady) {
+		if (HAL_GetTick() - start > timeout) {
+			//a frame in flight with the command shall not deliver its response to the next command
+			primask = __get_PRIMASK();
+			__disable_irq();
+			ADCcommandPending = false;
+			ADCcommandInFlight = false;
+			ADCcommandSent = false;
+			ADCresponseReady = false;
+			__set_PRIMASK(primask);
+			return HAL_TIMEOUT;
 		}
+	}
 
-		HAL_SPI_Transmit(ADC_SPI, ADCdummy, ADC_WORD_SIZE/8 * 5, ADC_TIMEOUT);
+	*response = ADCresponse;
 
-		ADC_CS_DISABLE();
+	return ADCresponseValid ? HAL_OK : HAL_ERROR;
+}
+
+//keeps the shadow cache after a register write, a failed write leaves the register content unknown
+static void ADCcacheWrite(uint8_t reg, uint16_t value, uint8_t res)
+{
+	if (reg >= ADC_CACHE_FIRST && reg <= ADC_CACHE_LAST) {
+		ADCregCache[reg - ADC_CACHE_FIRST] = value;
+		ADCregCacheValid[reg - ADC_CACHE_FIRST] = (res == HAL_OK);
+		ADCregmapCrcValid = false;
 	}
+}
 
-	while(HAL_GPIO_ReadPin(ADC_DRDY_GPIO_Port, ADC_DRDY_Pin) == GPIO_PIN_SET) {}
+/* Function      : ADCwriteReg
+ *
+ * Description   : Writes a register, skipping the write when the cache shows
+ *               the register already holds the value. While frames are
+ *               captured the command goes with the next frame.
+ *
+ * Parameters    : reg register address
+ *               data 24-bit data word, register contents in bits 23:8
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCwriteReg(uint8_t reg, uint32_t data)
+{
+	uint8_t commandWord[ADC_FRAME_SIZE];
+	uint8_t responseArr[ADC_FRAME_SIZE];
+	uint16_t value = (data >> 8) & 0xFFFF;
+	uint16_t command = WREG | (reg << 7);
+	uint16_t response = 0;
+	bool cached = (reg >= ADC_CACHE_FIRST && reg <= ADC_CACHE_LAST);
+	uint8_t res;
 
-	ADC_CS_ENABLE();
+	if (cached && ADCregCacheValid[reg - ADC_CACHE_FIRST] && ADCregCache[reg - ADC_CACHE_FIRST] == value) {
+		return HAL_OK;
+	}
 
-	while (ADC_SPI->State != HAL_SPI_STATE_READY) {
-		HAL_Delay(1);
+	if (ADCcaptureRunning()) {
+		ADCbuildCommand(ADCcommandFrame, command, &value, 1);
+		res = ADCframeCommand(&response);
+	} else {
+		ADCbuildCommand(commandWord, command, &value, 1);
+		res = ADCtransaction(commandWord, responseArr, ADClayout.wordBytes * ADC_FRAME_WORDS);
+		response = (responseArr[0] << 8) | responseArr[1];
 	}
 
-	HAL_SPI_Transmit(ADC_SPI, commandWord, ADC_WORD_SIZE/8 * 5, ADC_TIMEOUT);
+	res = (res == HAL_OK && response == (uint16_t)(WREG_RES | (reg << 7))) ? HAL_OK : HAL_ERROR;
+	ADCcacheWrite(reg, value, res);
 
-	ADC_CS_DISABLE();
+	return res;
+}
 
-	// Get response
+/* Function      : ADCwriteRegImmediate
+ *
+ * Description   : Writes a register without waiting for DRDY, the response is
+ *               read in the frame right after the command. Used to switch the
+ *               current detect mode, during which DRDY only comes on a
+ *               detection. The capture shall be suspended by the caller.
+ *
+ * Parameters    : reg register address
+ *               data 24-bit data word, register contents in bits 23:8
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+static uint8_t ADCwriteRegImmediate(uint8_t reg, uint32_t data)
+{
+	uint8_t commandWord[ADC_FRAME_SIZE];
+	uint8_t responseArr[ADC_FRAME_SIZE];
+	uint8_t frameSize = ADClayout.wordBytes * ADC_FRAME_WORDS;
+	uint16_t value = (data >> 8) & 0xFFFF;
+	uint16_t response;
+	uint8_t res;
 
-	while(HAL_GPIO_ReadPin(ADC_DRDY_GPIO_Port, ADC_DRDY_Pin) == GPIO_PIN_SET) {}
+	ADCbuildCommand(commandWord, WREG | (reg << 7), &value, 1);
 
-	ADC_CS_ENABLE();
+	spiBusLock();
+	checkAndConfigureSpiMode(ADC_SPI, ADC_CPOL, ADC_CPHA);
 
-	while (ADC_SPI->State != HAL_SPI_STATE_READY) {
-		HAL_Delay(1);
+	res = ADCframeTransfer(commandWord, NULL, frameSize);
+	if (res == HAL_OK) {
+		res = ADCframeTransfer(ADCdummy, responseArr, frameSize);
 	}
 
-	while (HAL_SPI_TransmitReceive(ADC_SPI, ADCdummy, responseArr, ADC_WORD_SIZE/8 * 5, ADC_TIMEOUT) == HAL_BUSY) {
+	spiBusUnlock();
+
+	response = (responseArr[0] << 8) | responseArr[1];
+	res = (res == HAL_OK && response == (uint16_t)(WREG_RES | (reg << 7))) ? HAL_OK : HAL_ERROR;
+	ADCcacheWrite(reg, value, res);
+
+	return res;
+}
+
+/* Function      : ADCreadReg
+ *
+ * Description   : Reads a single register with RREG. While frames are
+ *               captured the command goes with the next frame.
+ *
+ * Parameters    : reg register address
+ *               value destination of the register contents
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCreadReg(uint8_t reg, uint16_t *value)
+{
+	uint8_t commandWord[ADC_FRAME_SIZE];
+	uint8_t responseArr[ADC_FRAME_SIZE];
+	uint16_t response = 0;
+	uint8_t res;
+
+	if (ADCcaptureRunning()) {
+		ADCbuildCommand(ADCcommandFrame, RREG | (reg << 7), NULL, 0);
+		res = ADCframeCommand(&response);
+	} else {
+		ADCbuildCommand(commandWord, RREG | (reg << 7), NULL, 0);
+		res = ADCtransaction(commandWord, responseArr, ADClayout.wordBytes * ADC_FRAME_WORDS);
+		if (res == HAL_OK && !ADCcrcWordValid(responseArr, ADClayout.wordBytes * (ADC_FRAME_WORDS - 1))) {
+			res = HAL_ERROR;
+		}
+		response = (responseArr[0] << 8) | responseArr[1];
 	}
 
-	ADC_CS_DISABLE();
+	if (res != HAL_OK) {
+		return HAL_ERROR;
+	}
 
-  if ((responseWord[0] == responseArr[0]) && (responseWord[1] == responseArr[1]) && (responseWord[2] == responseArr[2])) {
-    return HAL_OK;
-  } else {
-    return HAL_ERROR;
-  }
+	*value = response;
+
+	return HAL_OK;
+}
+
+/* Function      : ADCreadRegs
+ *
+ * Description   : Reads consecutive registers with one RREG. The response is
+ *               longer than a frame, so it is always done in blocking mode.
+ *
+ * Parameters    : reg first register address
+ *               count number of registers, up to ADC_RREG_MAX
+ *               values destination of the register contents
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCreadRegs(uint8_t reg, uint8_t count, uint16_t *values)
+{
+	uint8_t commandWord[ADC_FRAME_SIZE];
+	uint8_t responseArr[ADC_RESPONSE_MAX_SIZE];
+	uint16_t ack = RREG_RES | (reg << 7) | (count - 1);
+	uint8_t crcOffset = ADClayout.wordBytes * (count + 1);
+
+	if (count == 0 || count > ADC_RREG_MAX) {
+		return HAL_ERROR;
+	}
+
+	if (count == 1) {
+		return ADCreadReg(reg, values);
+	}
+
+	ADCbuildCommand(commandWord, RREG | (reg << 7) | (count - 1), NULL, 0);
+
+	if (ADCtransaction(commandWord, responseArr, ADClayout.wordBytes * (count + 2)) != HAL_OK) {
+		return HAL_ERROR;
+	}
+
+	//acknowledge word, registers and CRC word
+	if (responseArr[0] != (uint8_t)(ack >> 8) || responseArr[1] != (uint8_t)ack || !ADCcrcWordValid(responseArr, crcOffset)) {
+		return HAL_ERROR;
+	}
+
+	for (uint8_t i = 0; i < count; i++) {
+		values[i] = (responseArr[ADClayout.wordBytes * (i + 1)] << 8) | responseArr[ADClayout.wordBytes * (i + 1) + 1];
+	}
+
+	return HAL_OK;
+}
+
+/* Function      : ADCverifyRegisters
+ *
+ * Description   : Reads back the whole cached register range and compares it
+ *               with the cache, filling the entries never written. On success
+ *               REGMAP_CRC is kept as the signature of the verified
+ *               configuration.
+ *
+ * Parameters    : None
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCverifyRegisters(void)
+{
+	uint16_t regs[ADC_CACHE_SIZE];
+	uint16_t crc;
+	uint8_t res;
+
+	ADCregmapCrcValid = false;
+
+	res = ADCreadRegs(ADC_CACHE_FIRST, ADC_CACHE_SIZE, regs);
+	if (res != HAL_OK) {
+		printf("[adc_spi.c]Error reading back registers.\n\r");
+		return res;
+	}
+
+	for (uint8_t i = 0; i < ADC_CACHE_SIZE; i++) {
+		if (!ADCregCacheValid[i]) {
+			ADCregCache[i] = regs[i];
+			ADCregCacheValid[i] = true;
+		} else if (ADCregCache[i] != regs[i]) {
+			printf("[adc_spi.c]Register 0x%02X is 0x%04X, expected 0x%04X.\n\r", ADC_CACHE_FIRST + i, regs[i], ADCregCache[i]);
+			res = HAL_ERROR;
+		}
+	}
+
+	if (res == HAL_OK && ADCreadReg(REGMAP_CRC, &crc) == HAL_OK) {
+		ADCregmapCrc = crc;
+		ADCregmapCrcValid = true;
+	}
+
+	return res;
+}
+
+/* Function      : ADCcheckRegisters
+ *
+ * Description   : Confirms the ADC configuration with a single REGMAP_CRC read.
+ *               The full readback is only done when the configuration
+ *               changed since the last verification or the CRC differs.
+ *
+ * Parameters    : None
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCcheckRegisters(void)
+{
+	uint16_t crc;
+
+	if (ADCregmapCrcValid && ADCreadReg(REGMAP_CRC, &crc) == HAL_OK && crc == ADCregmapCrc) {
+		return HAL_OK;
+	}
+
+	return ADCverifyRegisters();
 }
 
+/* Function      : ADCframeGainTag
+ *
+ * Description   : Returns the gain tag of the frame being read and advances
+ *               the filter settling count. Shall be called once per frame.
+ *
+ * Parameters    : None
+ *
+ * Returns       : ADC_GAIN_TAG, with ADC_GAIN_TAG_SETTLING while the frame
+ *               still holds data converted with the previous gains
+ */
+uint16_t ADCframeGainTag(void)
+{
+	uint16_t tag = ADCgainTag;
+
+	if (ADCgainSettle > 0 && --ADCgainSettle == 0) {
+		ADCgainTag &= ~ADC_GAIN_TAG_SETTLING;
+	}
+
+	return tag;
+}
+
+uint16_t ADCgetGainTag(void)
+{
+	return ADCgainTag;
+}
+
+/* Function      : ADCsetGain
+ *
+ * Description   : Sets the PGA of the three channels. While frames are
+ *               captured the GAIN write goes with the next frame and the
+ *               samples are tagged with the new gains from the frame that
+ *               follows it, so acquisition never stops.
+ *
+ * Parameters    : log2GainCHx log2 of the channel gain, GAIN_PGA_GAIN_x
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
 uint8_t ADCsetGain(uint8_t log2GainCH0, uint8_t log2GainCH1, uint8_t log2GainCH2)
 {
-  uint32_t gainData = 0x00000000 + ((0x07 & log2GainCH0)<<16) + ((0x07 & log2GainCH1) << 20) + ((0x07 & log2GainCH2) << 24);
+  uint16_t tag = ADC_GAIN_TAG(log2GainCH0, log2GainCH1, log2GainCH2);
+  uint8_t res;
+  uint32_t primask;
+
+  //PGAGAIN0 in bits 2:0, PGAGAIN1 in bits 6:4 and PGAGAIN2 in bits 10:8 of the register
+  uint32_t gainData = 0x00000000 + ((0x07 & log2GainCH0) << 8) + ((0x07 & log2GainCH1) << 12) + ((0x07 & log2GainCH2) << 16);
+
+  ADCgainTagNext = tag;
+  ADCgainWriting = true;
+  res = ADCwriteReg(GAIN, gainData);
+  ADCgainWriting = false;
+
+  //the untagged conversions keep the scales of the gains the ADC runs at
+  if (res == HAL_OK) {
+    ADClog2Gain[0] = 0x07 & log2GainCH0;
+    ADClog2Gain[1] = 0x07 & log2GainCH1;
+    ADClog2Gain[2] = 0x07 & log2GainCH2;
+
+    ADCupdateScaleFactors(ADClog2Gain);
+  }
+
+  //blocking write, the capture was suspended meanwhile
+  if (res == HAL_OK && (ADCgainTag & ADC_GAIN_TAG_MASK) != tag) {
+    primask = __get_PRIMASK();
+    __disable_irq();
+    ADCgainTag = tag | ADC_GAIN_TAG_SETTLING;
+    ADCgainSettle = ADC_GAIN_SETTLE_FRAMES;
+    __set_PRIMASK(primask);
+  }
+
+  return res;
+}
+
+/* Function      : ADCwriteCalibration
+ *
+ * Description   : Writes the offset and gain calibration of a channel. The ADC
+ *               subtracts the offset from the conversion result and then
+ *               multiplies it by gain / GCAL_DEFAULT.
+ *
+ * Parameters    : channel ADC channel
+ *               offset 24-bit two's complement offset, in codes
+ *               gain 24-bit unsigned gain, GCAL_DEFAULT is 1.0
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCwriteCalibration(uint8_t channel, int32_t offset, uint32_t gain)
+{
+	uint8_t reg = CH0_OCAL_MSB + channel * ADC_CH_REG_STRIDE;
+	uint8_t res = HAL_OK;
+
+	if (channel > 2) {
+		return HAL_ERROR;
+	}
+
+	res |= ADCwriteReg(reg, ((uint32_t)offset & 0xFFFF00));
+	res |= ADCwriteReg(reg + 1, ((uint32_t)offset & 0x0000FF) << 16);
+	res |= ADCwriteReg(reg + 2, (gain & 0xFFFF00));
+	res |= ADCwriteReg(reg + 3, (gain & 0x0000FF) << 16);
+
+	return res == HAL_OK ? HAL_OK : HAL_ERROR;
+}
+
+/* Function      : ADCwritePhase
+ *
+ * Description   : Sets the phase delay of a channel, used to align channels
+ *               whose analog front ends have different delays.
+ *
+ * Parameters    : channel ADC channel
+ *               phase delay in modulator clock periods, ADC_PHASE_MIN to
+ *               ADC_PHASE_MAX
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCwritePhase(uint8_t channel, int16_t phase)
+{
+	if (channel > 2 || phase < ADC_PHASE_MIN || phase > ADC_PHASE_MAX) {
+		return HAL_ERROR;
+	}
+
+	return ADCwriteReg(CH0_CFG + channel * ADC_CH_REG_STRIDE, (((uint32_t)phase & CFG_PHASE_MASK) << CFG_PHASE_SHIFT) << 8);
+}
+
+/* Function      : ADCsetClkin
+ *
+ * Description   : Changes the period of the TIM16 output that clocks the ADC,
+ *               keeping a 50% duty cycle.
+ *
+ * Parameters    : period timer period, CLKIN = ADC_CLKIN_TIMER_FREQ / (period + 1)
+ *
+ * Returns       : None
+ */
+static void ADCsetClkin(uint16_t period)
+{
+	__HAL_TIM_SET_AUTORELOAD(&htim16, period);
+	__HAL_TIM_SET_COMPARE(&htim16, TIM_CHANNEL_1, (period + 1) / 2);
+}
+
+/* Function      : ADCsetProfile
+ *
+ * Description   : Switches the ADC data rate and power mode. The CLOCK
+ *               register write suspends the capture until the frame in flight
+ *               is done, so the switch happens at a frame boundary and the log
+ *               session keeps running. The power mode is raised before a
+ *               faster CLKIN is applied and lowered after a slower one, so it
+ *               always matches the clock.
+ *
+ * Parameters    : id profile to switch to
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCsetProfile(ADCprofileId id)
+{
+	const ADCprofileTypedef *profile;
+	uint32_t regConfig;
+	uint8_t res;
+
+	if (id >= ADC_PROFILE_QTY) {
+		return HAL_ERROR;
+	}
+
+	profile = &ADCprofiles[id];
+	regConfig = (CLOCK_CH_EN(ADClayout.channelMask) | CLOCK_TBM | profile->clockOsr | profile->clockPwr);
+
+	if (profile->clkinPeriod <= ADCprofiles[ADCprofile].clkinPeriod) {
+		res = ADCwriteReg(CLOCK, regConfig);
+		ADCsetClkin(profile->clkinPeriod);
+	} else {
+		ADCsetClkin(profile->clkinPeriod);
+		res = ADCwriteReg(CLOCK, regConfig);
+	}
+
+	//the ADC keeps the previous profile, so does CLKIN
+	if (res != HAL_OK) {
+		ADCsetClkin(ADCprofiles[ADCprofile].clkinPeriod);
+		return res;
+	}
+
+	ADCprofile = id;
+	printf("[adc_spi.c]Profile %s, %lu SPS.\n\r", profile->name, profile->dataRate);
+
+	return res;
+}
+
+ADCprofileId ADCgetProfile(void)
+{
+	return ADCprofile;
+}
+
+//MODE WLENGTH field of a word length, 32-bit words are sign-extended. 0 if not supported
+static uint32_t ADCwordLength(uint8_t wordBits)
+{
+	switch (wordBits) {
+	case 16: return MODE_WLENGTH_16;
+	case 24: return MODE_WLENGTH_24;
+	case 32: return MODE_WLENGTH_32_M;
+	default: return 0;
+	}
+}
+
+/* Function      : ADCsetLayout
+ *
+ * Description   : Changes the enabled channels and the word length, and with
+ *               them the frame read on every DRDY. The capture is suspended
+ *               meanwhile and the queued frames of the previous layout are
+ *               discarded.
+ *
+ * Parameters    : channelMask enabled channels, bit n for CHn, not 0
+ *               wordBits 16, 24 or 32 (sign-extended)
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCsetLayout(uint8_t channelMask, uint8_t wordBits)
+{
+	const ADCprofileTypedef *profile = &ADCprofiles[ADCprofile];
+	uint32_t wlength;
+	bool captureRunning;
+	uint8_t res;
+
+	channelMask &= ADC_CHANNEL_MASK_ALL;
+	if (channelMask == 0) {
+		return HAL_ERROR;
+	}
+
+	if ((wlength = ADCwordLength(wordBits)) == 0) {
+		return HAL_ERROR;
+	}
+
+	captureRunning = ADCsuspendCapture();
+
+	res = ADCwriteReg(CLOCK, CLOCK_CH_EN(channelMask) | CLOCK_TBM | profile->clockOsr | profile->clockPwr);
+	if (res == HAL_OK) {
+		ADCupdateLayout(channelMask, ADClayout.modeWlength);
+
+		//the response to the MODE write already comes in the new word length, its
+		//first 16 bits are the same in every length
+		res = ADCwriteReg(MODE, ADC_MODE_CONFIG | wlength);
+		if (res == HAL_OK) {
+			ADCupdateLayout(channelMask, wlength);
+		}
+	}
+
+	while (sampleQueuePeek() != NULL) {
+		sampleQueueRelease();
+	}
+
+	ADCresumeCapture(captureRunning);
+
+	if (res != HAL_OK) {
+		printf("[adc_spi.c]Error changing the frame layout.\n\r");
+		return HAL_ERROR;
+	}
+
+	printf("[adc_spi.c]Channels 0x%X, %u-bit words, %u bytes per frame.\n\r", ADClayout.channelMask, wordBits, ADClayout.frameSize);
+
+	return HAL_OK;
+}
+
+/* Function      : ADCswitchClock
+ *
+ * Description   : Writes CLOCK for a profile and a channel mask with
+ *               ADCwriteRegImmediate, retuning CLKIN in the same order as
+ *               ADCsetProfile, and makes the matching layout active. The
+ *               capture shall be suspended by the caller.
+ *
+ * Parameters    : id profile to switch to
+ *               channelMask enabled channels, bit n for CHn
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+static uint8_t ADCswitchClock(ADCprofileId id, uint8_t channelMask)
+{
+	const ADCprofileTypedef *profile = &ADCprofiles[id];
+	uint32_t regConfig = (CLOCK_CH_EN(channelMask) | CLOCK_TBM | profile->clockOsr | profile->clockPwr);
+	uint8_t res;
+
+	if (profile->clkinPeriod <= ADCprofiles[ADCprofile].clkinPeriod) {
+		res = ADCwriteRegImmediate(CLOCK, regConfig);
+		ADCsetClkin(profile->clkinPeriod);
+	} else {
+		ADCsetClkin(profile->clkinPeriod);
+		res = ADCwriteRegImmediate(CLOCK, regConfig);
+	}
+
+	if (res == HAL_OK) {
+		ADCprofile = id;
+		ADCupdateLayout(channelMask, ADClayout.modeWlength);
+	}
+
+	return res;
+}
+
+/* Function      : ADCenterStandby
+ *
+ * Description   : Puts the ADC in standby: HV channels only, parked profile
+ *               and current detect, so DRDY only comes when a conversion
+ *               goes over the threshold. The queued frames are discarded,
+ *               the configuration in use is kept for ADCexitStandby.
+ *
+ * Parameters    : thresholdCode wake threshold, code magnitude (24-bit units)
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCenterStandby(uint32_t thresholdCode)
+{
+	bool captureRunning;
+	uint8_t res;
+
+	if (ADCstandby) {
+		return HAL_OK;
+	}
+
+	thresholdCode = thresholdCode > ADC_THRESHOLD_MAX ? ADC_THRESHOLD_MAX : thresholdCode;
+
+	ADCstandbyProfile = ADCprofile;
+	ADCstandbyMask = ADClayout.channelMask;
+	ADCstandbyCfg = ADCregCacheValid[CFG - ADC_CACHE_FIRST] ? ((uint32_t)ADCregCache[CFG - ADC_CACHE_FIRST] << 8) : CFG_DEFAULT;
+
+	captureRunning = ADCsuspendCapture();
+
+	res = ADCwriteRegImmediate(THRSHLD_MSB, THRSHLD_MSB_DATA(thresholdCode));
+	if (res == HAL_OK) {
+		res = ADCwriteRegImmediate(THRSHLD_LSB, THRSHLD_LSB_DATA(thresholdCode));
+	}
+	if (res == HAL_OK) {
+		res = ADCswitchClock(ADC_PROFILE_PARKED, ADC_STANDBY_CHANNELS);
+	}
+	if (res == HAL_OK) {
+		res = ADCwriteRegImmediate(CFG, (ADCstandbyCfg & ~CFG_CD_MASK) | ADC_STANDBY_CD);
+	}
+	ADCstandby = (res == HAL_OK);
+
+	while (sampleQueuePeek() != NULL) {
+		sampleQueueRelease();
+	}
+
+	ADCresumeCapture(captureRunning);
+
+	if (res != HAL_OK) {
+		printf("[adc_spi.c]Error entering the standby.\n\r");
+		ADCexitStandby();
+	}
+
+	return res;
+}
+
+/* Function      : ADCexitStandby
+ *
+ * Description   : Leaves the current detect mode and restores the profile and
+ *               the channels in use before the standby. The writes do not
+ *               wait for DRDY, full rate frames come one conversion later.
+ *
+ * Parameters    : None
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t ADCexitStandby(void)
+{
+	bool captureRunning = ADCsuspendCapture();
+	uint8_t res;
 
-  ADCgain[0] = pow(2, (double)log2GainCH0);
-  ADCgain[1] = pow(2, (double)log2GainCH1);
-  ADCgain[2] = pow(2, (double)log2GainCH2);
+	res = ADCwriteRegImmediate(CFG, ADCstandbyCfg);
+	if (res == HAL_OK) {
+		res = ADCswitchClock(ADCstandbyProfile, ADCstandbyMask);
+	}
+	ADCstandby = false;
+
+	ADCresumeCapture(captureRunning);
+
+	//a failure is left to the DRDY watchdog, its reset clears the current detect mode
+	if (res != HAL_OK) {
+		printf("[adc_spi.c]Error leaving the standby.\n\r");
+	}
 
-  return ADCwriteReg(GAIN, gainData);
+	return res;
+}
+
+bool ADCinStandby(void)
+{
+	return ADCstandby;
+}
+
+/* Function      : ADCrecover
+ *
+ * Description   : Brings a stalled ADC back: pulses RESET, writes MODE in the
+ *               active word length, replays the registers of the shadow
+ *               cache and verifies them. The capture is suspended meanwhile,
+ *               the frames already queued are kept.
+ *
+ * Parameters    : None
+ *
+ * Returns       : HAL_OK, HAL_ERROR or HAL_TIMEOUT
+ */
+static uint8_t ADCrecover(void)
+{
+	uint16_t regs[ADC_CACHE_SIZE];
+	bool valid[ADC_CACHE_SIZE];
+	uint8_t channelMask = ADClayout.channelMask;
+	uint32_t wlength = ADClayout.modeWlength;
+	bool captureRunning = ADCsuspendCapture();
+	uint8_t res;
+
+	//after the reset the ADC holds its power on configuration
+	memcpy(regs, ADCregCache, sizeof(regs));
+	memcpy(valid, ADCregCacheValid, sizeof(valid));
+	memset(ADCregCacheValid, 0, sizeof(ADCregCacheValid));
+	ADCregmapCrcValid = false;
+
+	HAL_GPIO_WritePin(ADC_RESET_GPIO_Port, ADC_RESET_Pin, GPIO_PIN_RESET);
+	HAL_Delay(ADC_RESET_PULSE_MS);
+	HAL_GPIO_WritePin(ADC_RESET_GPIO_Port, ADC_RESET_Pin, GPIO_PIN_SET);
+
+	//power on word length until MODE is written
+	ADCupdateLayout(ADC_CHANNEL_MASK_ALL, MODE_WLENGTH_24);
+
+	res = ADCwaitDrdy();
+	if (res == HAL_OK) {
+		res = ADCwriteReg(MODE, ADC_MODE_CONFIG | wlength);
+	}
+	if (res == HAL_OK) {
+		ADCupdateLayout(ADC_CHANNEL_MASK_ALL, wlength);
+	}
+
+	for (uint8_t i = 0; i < ADC_CACHE_SIZE && res == HAL_OK; i++) {
+		if (valid[i] && ADC_CACHE_FIRST + i != MODE) {
+			res = ADCwriteReg(ADC_CACHE_FIRST + i, (uint32_t)regs[i] << 8);
+		}
+	}
+
+	ADCupdateLayout(channelMask, wlength);
+
+	if (res == HAL_OK) {
+		res = ADCverifyRegisters();
+	}
+
+	ADCresumeCapture(captureRunning);
+
+	return res;
+}
+
+/* Function      : ADCwatchdog
+ *
+ * Description   : DRDY watchdog, called from the main loop. When the frame
+ *               sequence has not moved for ADC_WATCHDOG_PERIODS data periods
+ *               of the active profile the ADC is reset and its configuration
+ *               replayed. The outage is kept for the log.
+ *
+ * Parameters    : None
+ *
+ * Returns       : None
+ */
+void ADCwatchdog(void)
+{
+	uint32_t now = timebaseMicros();
+	uint32_t sequence = ADCsequence;
+	uint32_t timeout = ADC_WATCHDOG_PERIODS * (1000000 / ADCprofiles[ADCprofile].dataRate) + ADC_WATCHDOG_MARGIN_US;
+
+	//configuration lost without a stall, e.g. RESET seen in STATUS
+	if (ADCrecoveryRequested && !ADCstandby) {
+		ADCrecoveryRequested = false;
+		printf("[adc_spi.c]Restoring the ADC configuration.\n\r");
+		if (ADCrecover() != HAL_OK) {
+			ADCoutage.failures++;
+			printf("[adc_spi.c]ADC recovery failed.\n\r");
+		}
+		ADCwatchdogSequence = ADCsequence;
+		ADCwatchdogStamp = timebaseMicros();
+		return;
+	}
+
+	//only while frames are expected, in standby DRDY only comes on a detection
+	if (ADC_SPI == NULL || ADCstandby || NVIC_GetEnableIRQ(ADC_DRDY_EXTI_IRQn) == 0 || sequence != ADCwatchdogSequence) {
+		ADCwatchdogSequence = sequence;
+		ADCwatchdogStamp = now;
+		ADCstalled = false;
+		return;
+	}
+
+	//the stamp is pushed ahead by the backoff after a failed recovery
+	if ((int32_t)(now - ADCwatchdogStamp) <= (int32_t)timeout) {
+		return;
+	}
+
+	if (!ADCstalled) {
+		ADCstalled = true;
+		ADCstallStart = ADCwatchdogStamp;
+		printf("[adc_spi.c]No DRDY for %lu us, resetting the ADC.\n\r", now - ADCwatchdogStamp);
+	}
+
+	if (ADCrecover() != HAL_OK) {
+		ADCoutage.failures++;
+		ADCwatchdogStamp = timebaseMicros() + ADC_WATCHDOG_BACKOFF_US;
+		printf("[adc_spi.c]ADC recovery failed.\n\r");
+		return;
+	}
+
+	now = timebaseMicros();
+	ADCstalled = false;
+	ADCoutage.duration = now - ADCstallStart;
+	ADCoutage.resumeSequence = ADCsequence;
+	ADCoutage.count++;
+
+	ADCwatchdogSequence = ADCsequence;
+	ADCwatchdogStamp = now;
+
+	printf("[adc_spi.c]ADC recovered after %lu us.\n\r", ADCoutage.duration);
+}
+
+//asks the watchdog to reset the ADC and replay its configuration on its next check
+void ADCrequestRecovery(void)
+{
+	ADCrecoveryRequested = true;
+}
+
+const ADCoutageTypedef *ADCgetOutage(void)
+{
+	return &ADCoutage;
+}
+
+const ADCprofileTypedef *ADCgetProfileInfo(ADCprofileId id)
+{
+	return &ADCprofiles[id < ADC_PROFILE_QTY ? id : ADCprofile];
+}
+
+//returns the profile id matching the name, -1 if unknown
+int8_t ADCfindProfile(const char *name)
+{
+	for (uint8_t i = 0; i < ADC_PROFILE_QTY; i++) {
+		if (!strncmp(name, ADCprofiles[i].name, sizeof(ADCprofiles[i].name))) {
+			return i;
+		}
+	}
+
+	return -1;
 }
 
 uint8_t ADCinit(SPI_HandleTypeDef * hspi)
@@ -152,21 +1523,27 @@ uint8_t ADCinit(SPI_HandleTypeDef * hspi)
 	uint32_t regConfig;
 	uint8_t res;
 
-	//fills dummy communication array with dummy data to be used when getting a response or capturing ADC data
-	for (uint8_t i = 0; i<(ADC_WORD_SIZE/8 * 5); i++) {
-		ADCdummy[i] = DUMMY;
-	}
+	ADCcrcInit();
 
-	while(HAL_GPIO_ReadPin(ADC_DRDY_GPIO_Port, ADC_DRDY_Pin) == GPIO_PIN_SET) {}
+	//all channels in 24-bit words, the power on word length. Also fills the dummy
+	//communication array used when getting a response or capturing ADC data
+	ADCupdateLayout(ADC_CHANNEL_MASK_ALL, MODE_WLENGTH_24);
 
-	//write mode register to clear reset flag and make DRDY active low pulse
-	regConfig = (MODE_REG_CRC_EN | MODE_RX_CRC_EN | MODE_CRC_TYPE | MODE_RESET_CLEAR |
-			   MODE_WLENGTH | MODE_TIMEOUT | MODE_DRDY_SEL | MODE_DRDY_HIZ | MODE_DRDY_FMT_PULSE);
+	if (ADCwaitDrdy() != HAL_OK) {
+	  printf("[adc_spi.c]No DRDY from the ADC.\n\r");
+	  return HAL_TIMEOUT;
+	}
+
+	//write mode register to clear reset flag, enable input and register map CRC and make DRDY active low pulse
+	//the response already comes in the build-time word length, its first 16 bits are the
+	//same in every length
+	regConfig = (ADC_MODE_CONFIG | ADCwordLength(ADC_DEFAULT_WORD_BITS));
 	res = ADCwriteReg(MODE, regConfig);
 	if (res == HAL_ERROR){
 	  printf("[adc_spi.c]Error setting MODE register.\n\r");
 	  return res;
 	}
+	ADCupdateLayout(ADC_CHANNEL_MASK_ALL, ADCwordLength(ADC_DEFAULT_WORD_BITS));
 
 	//set CH0 gain to 32, CH1 to 128 and CH2 to 128
 	res = ADCsetGain(GAIN_PGA_GAIN_32, GAIN_PGA_GAIN_128, GAIN_PGA_GAIN_64);
@@ -175,14 +1552,29 @@ uint8_t ADCinit(SPI_HandleTypeDef * hspi)
 	  return res;
 	}
 
-	//set OSR to 16256
-	regConfig = (CLOCK_CH0_EN | CLOCK_CH1_EN | CLOCK_CH2_EN | CLOCK_TBM | CLOCK_OSR_16256 | CLOCK_PWR);
-	res = ADCwriteReg(CLOCK, regConfig);
+	//set OSR and power mode of the default profile (OSR 16256, high resolution)
+	ADCprofile = ADC_DEFAULT_PROFILE;
+	res = ADCsetProfile(ADC_DEFAULT_PROFILE);
 	if (res == HAL_ERROR){
 	  printf("[adc_spi.c]Error setting OSR register.\n\r");
 	  return res;
 	}
 
+	//offset and gain calibration stored in the EEPROM identification page
+	res = ADCloadCalibration();
+	if (res == HAL_ERROR){
+	  printf("[adc_spi.c]Error setting calibration registers.\n\r");
+	  return res;
+	}
+
+	//reads the configuration back once, later checks only compare REGMAP_CRC
+	if (ADCverifyRegisters() != HAL_OK){
+	  printf("[adc_spi.c]Register readback does not match the configuration.\n\r");
+	}
+
+	sampleQueueReset();
+	spiSetBusReleaseHook(ADCbusReleased);
+
 	HAL_NVIC_EnableIRQ(EXTI3_IRQn);
 
 	printf("[adc_spi.c]ADC initialized OK.\n\r");
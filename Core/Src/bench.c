@@ -0,0 +1,510 @@
+/*******************************************************************************
+  * File Name			: bench.c
+  * Description			: This module implements on-target benchmarks of the
+  * 					  sample processing routines. Cycles are measured with
+  * 					  the DWT cycle counter over synthetic ADC frames and
+  * 					  reported through the standard IO.
+  *
+  * Date				: October 17, 2026
+  ******************************************************************************
+  */
+
+#include "bench.h"
+#include "adc_spi.h"
+#include "adc.h"
+#include "filter.h"
+#include "log.h"
+#include <string.h>
+
+uint8_t benchFrames[BENCH_FRAMES][ADC_FRAME_SIZE] __ALIGNED(4);
+uint8_t benchWordFrames[2][BENCH_FRAMES][ADC_FRAME_SIZE] __ALIGNED(4);	//24-bit and 32-bit sign-extended
+volatile int32_t benchSink;		//keeps the optimizer from removing the measured code
+int32_t benchCodes[2][3][BENCH_FRAMES];		//scalar and batched unpack results
+statsSnapshotTypedef benchStatsSnapshot;		//session statistics kept across benchStats, too large for the stack
+
+/* Function      : benchCycleCounterInit
+ *
+ * Description   : Enables the DWT cycle counter.
+ *
+ * Parameters    : None
+ *
+ * Returns       : None
+ */
+void benchCycleCounterInit(void)
+{
+	//the counter is not cleared, it also drives the sample timebase
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t benchCycles(void)
+{
+	return DWT->CYCCNT;
+}
+
+/* Function      : benchFillFrames
+ *
+ * Description   : Fills the synthetic frames with pseudo random 24-bit codes
+ *               covering the whole signed range of every channel.
+ *
+ * Parameters    : None
+ *
+ * Returns       : None
+ */
+static void benchFillFrames(void)
+{
+	uint32_t seed = 0x1234567;
+
+	for (uint16_t i = 0; i < BENCH_FRAMES; i++) {
+		for (uint8_t j = 0; j < ADC_FRAME_SIZE; j++) {
+			seed = seed * 1664525 + 1013904223;
+			benchFrames[i][j] = seed >> 24;
+		}
+	}
+}
+
+/* Function      : benchConversion
+ *
+ * Description   : Compares the fixed-point conversion against the double
+ *               precision one, both in cycles per frame and in accuracy.
+ *
+ * Parameters    : None
+ *
+ * Returns       : true if the fixed-point error is within BENCH_FIXED_MAX_ERROR
+ */
+static bool benchConversion(void)
+{
+	uint32_t start, doubleCycles = 0, fixedCycles = 0;
+	int64_t error, maxError = 0;
+	double *doubleData;
+	int32_t *fixedData;
+
+	for (uint8_t pass = 0; pass < BENCH_PASSES; pass++) {
+		start = benchCycles();
+		for (uint16_t i = 0; i < BENCH_FRAMES; i++) {
+			benchSink = (int32_t)getADCConvertedData(benchFrames[i])[HV_VOLTAGE_CH];
+		}
+		doubleCycles += benchCycles() - start;
+
+		start = benchCycles();
+		for (uint16_t i = 0; i < BENCH_FRAMES; i++) {
+			benchSink = getADCConvertedFixed(benchFrames[i])[HV_VOLTAGE_CH];
+		}
+		fixedCycles += benchCycles() - start;
+	}
+
+	for (uint16_t i = 0; i < BENCH_FRAMES; i++) {
+		doubleData = getADCConvertedData(benchFrames[i]);
+		fixedData = getADCConvertedFixed(benchFrames[i]);
+
+		for (uint8_t ch = 0; ch < 3; ch++) {
+			error = (int64_t)fixedData[ch] - (int64_t)(doubleData[ch] * ADC_FIXED_SCALE);
+			error = error < 0 ? -error : error;
+			maxError = error > maxError ? error : maxError;
+		}
+	}
+
+	printf("[bench.c]Conversion double: %lu cycles/frame\n\r", doubleCycles / (BENCH_FRAMES * BENCH_PASSES));
+	printf("[bench.c]Conversion fixed: %lu cycles/frame\n\r", fixedCycles / (BENCH_FRAMES * BENCH_PASSES));
+	printf("[bench.c]Conversion fixed max error: %lu micro-units (bound %d)\n\r", (uint32_t)maxError, BENCH_FIXED_MAX_ERROR);
+
+	return maxError <= BENCH_FIXED_MAX_ERROR;
+}
+
+/* Function      : benchUnpack
+ *
+ * Description   : Compares the batched frame unpacking against the scalar
+ *               convert24bitTo32bit, in cycles per frame and in results. The
+ *               scalar routine reads 24-bit codes, the results are only
+ *               compared in layouts with every channel in 24 or zero padded
+ *               32-bit words.
+ *
+ * Parameters    : None
+ *
+ * Returns       : true if both routines give the same codes
+ */
+static bool benchUnpack(void)
+{
+	uint32_t start, scalarCycles = 0, batchCycles = 0;
+	int32_t *const batch[3] = { benchCodes[1][0], benchCodes[1][1], benchCodes[1][2] };
+	const ADCframeLayoutTypedef *layout = ADCgetLayout();
+	bool comparable = (layout->wordBytes > 2 && !layout->signExtended && layout->channelMask == ADC_CHANNEL_MASK_ALL);
+	bool match = true;
+
+	for (uint8_t pass = 0; pass < BENCH_PASSES; pass++) {
+		start = benchCycles();
+		for (uint16_t i = 0; i < BENCH_FRAMES; i++) {
+			for (uint8_t ch = 0; ch < 3; ch++) {
+				benchCodes[0][ch][i] = convert24bitTo32bit(&(benchFrames[i][layout->channelOffset[ch]]));
+			}
+		}
+		scalarCycles += benchCycles() - start;
+
+		start = benchCycles();
+		ADCunpackFrames(benchFrames[0], ADC_FRAME_SIZE, BENCH_FRAMES, batch);
+		batchCycles += benchCycles() - start;
+	}
+
+	for (uint8_t ch = 0; ch < 3 && comparable; ch++) {
+		for (uint16_t i = 0; i < BENCH_FRAMES; i++) {
+			match &= (benchCodes[0][ch][i] == benchCodes[1][ch][i]);
+		}
+	}
+
+	printf("[bench.c]Unpack scalar: %lu cycles/frame\n\r", scalarCycles / (BENCH_FRAMES * BENCH_PASSES));
+	printf("[bench.c]Unpack batched: %lu cycles/frame (%u-byte frames)\n\r", batchCycles / (BENCH_FRAMES * BENCH_PASSES), layout->frameSize);
+	printf("[bench.c]Unpack results %s.\n\r", !comparable ? "not compared in this layout" : (match ? "match" : "differ"));
+
+	return match;
+}
+
+/* Function      : benchWordLength
+ *
+ * Description   : Converts the same codes framed in 24-bit words and in 32-bit
+ *               sign-extended words, in cycles per frame, and checks both give
+ *               the same values.
+ *
+ * Parameters    : None
+ *
+ * Returns       : true if both word lengths convert to the same values
+ */
+static bool benchWordLength(void)
+{
+	ADCframeLayoutTypedef layout[2];
+	uint32_t start, cycles[2] = {0, 0};
+	int32_t code, converted[3];
+	uint32_t seed = 0x2468ACE;
+	bool match = true;
+
+	ADCcomputeLayout(&layout[0], ADC_CHANNEL_MASK_ALL, MODE_WLENGTH_24);
+	ADCcomputeLayout(&layout[1], ADC_CHANNEL_MASK_ALL, MODE_WLENGTH_32_M);
+
+	for (uint16_t i = 0; i < BENCH_FRAMES; i++) {
+		for (uint8_t ch = 0; ch < 3; ch++) {
+			seed = seed * 1664525 + 1013904223;
+			code = (int32_t)seed >> 8;
+
+			benchWordFrames[0][i][layout[0].channelOffset[ch]] = code >> 16;
+			benchWordFrames[0][i][layout[0].channelOffset[ch] + 1] = code >> 8;
+			benchWordFrames[0][i][layout[0].channelOffset[ch] + 2] = code;
+
+			benchWordFrames[1][i][layout[1].channelOffset[ch]] = code >> 24;
+			benchWordFrames[1][i][layout[1].channelOffset[ch] + 1] = code >> 16;
+			benchWordFrames[1][i][layout[1].channelOffset[ch] + 2] = code >> 8;
+			benchWordFrames[1][i][layout[1].channelOffset[ch] + 3] = code;
+		}
+	}
+
+	for (uint8_t pass = 0; pass < BENCH_PASSES; pass++) {
+		for (uint8_t w = 0; w < 2; w++) {
+			start = benchCycles();
+			for (uint16_t i = 0; i < BENCH_FRAMES; i++) {
+				benchSink = getADCConvertedFixedLayout(benchWordFrames[w][i], &layout[w])[HV_VOLTAGE_CH];
+			}
+			cycles[w] += benchCycles() - start;
+		}
+	}
+
+	for (uint16_t i = 0; i < BENCH_FRAMES; i++) {
+		memcpy(converted, getADCConvertedFixedLayout(benchWordFrames[0][i], &layout[0]), sizeof(converted));
+		match &= !memcmp(converted, getADCConvertedFixedLayout(benchWordFrames[1][i], &layout[1]), sizeof(converted));
+	}
+
+	printf("[bench.c]Conversion 24-bit words: %lu cycles/frame\n\r", cycles[0] / (BENCH_FRAMES * BENCH_PASSES));
+	printf("[bench.c]Conversion 32-bit sign-extended words: %lu cycles/frame\n\r", cycles[1] / (BENCH_FRAMES * BENCH_PASSES));
+	printf("[bench.c]Word length results %s.\n\r", match ? "match" : "differ");
+
+	return match;
+}
+
+/* Function      : benchFilter
+ *
+ * Description   : Measures the decimation filter in cycles per input sample
+ *               (three channels) at the data rate of every ADC profile and
+ *               the CPU load it means, then checks a DC input comes out
+ *               unchanged within one FIR step.
+ *
+ * Parameters    : None
+ *
+ * Returns       : true if the DC output is within one step of the input
+ */
+static bool benchFilter(void)
+{
+	uint32_t inputRate = filterGetInputRate();
+	uint16_t outputRate = filterGetOutputRate();
+	const ADCprofileTypedef *profile;
+	uint32_t start, cycles;
+	int32_t input[FILTER_CHANNELS], output[FILTER_CHANNELS] = {0};
+	int32_t dc[FILTER_CHANNELS] = {1234567, -150000000, 400123456};
+	int32_t error, maxError = 0;
+	uint32_t seed = 0x7654321;
+
+	for (uint8_t id = 0; id < ADC_PROFILE_QTY; id++) {
+		profile = ADCgetProfileInfo((ADCprofileId)id);
+		filterConfigure(profile->dataRate, FILTER_DEFAULT_RATE);
+		cycles = 0;
+
+		for (uint16_t i = 0; i < BENCH_FILTER_SAMPLES; i++) {
+			for (uint8_t ch = 0; ch < FILTER_CHANNELS; ch++) {
+				seed = seed * 1664525 + 1013904223;
+				input[ch] = (int32_t)seed >> 2;
+			}
+
+			start = benchCycles();
+			benchSink = filterProcess(input, output);
+			cycles += benchCycles() - start;
+		}
+
+		printf("[bench.c]Filter %s (%lu SPS, decimation %lu): %lu cycles/sample, %lu.%02lu%% CPU\n\r", profile->name, profile->dataRate,
+				filterGetDecimation(), cycles / BENCH_FILTER_SAMPLES,
+				(uint32_t)((uint64_t)cycles * profile->dataRate * 100 / BENCH_FILTER_SAMPLES / SystemCoreClock),
+				(uint32_t)((uint64_t)cycles * profile->dataRate * 10000 / BENCH_FILTER_SAMPLES / SystemCoreClock) % 100);
+	}
+
+	//DC response, once the filter is filled
+	filterConfigure(ADCgetProfileInfo(ADC_PROFILE_PRECISION)->dataRate, FILTER_DEFAULT_RATE);
+	for (uint32_t i = 0; i < 4 * filterGetDecimation() * FILTER_FIR_TAPS; i++) {
+		filterProcess(dc, output);
+	}
+
+	for (uint8_t ch = 0; ch < FILTER_CHANNELS; ch++) {
+		error = output[ch] - dc[ch];
+		error = error < 0 ? -error : error;
+		maxError = error > maxError ? error : maxError;
+	}
+
+	printf("[bench.c]Filter DC max error: %ld micro-units (bound %d)\n\r", maxError, FILTER_STEP_HV_VOLTAGE);
+
+	filterConfigure(inputRate, outputRate);
+
+	return maxError <= FILTER_STEP_HV_VOLTAGE;
+}
+
+/* Function      : benchRules
+ *
+ * Description   : Compares the log trigger and rules evaluated on micro-units,
+ *               which takes the conversion of the HV channels, against the
+ *               evaluation on raw codes with the per gain thresholds, in
+ *               cycles per sample and in results.
+ *
+ * Parameters    : None
+ *
+ * Returns       : true if both evaluations agree on every frame
+ */
+static bool benchRules(void)
+{
+	const ADCframeLayoutTypedef *layout = ADCgetLayout();
+	uint16_t gainTag = ADCgetGainTag();
+	uint32_t start, fixedCycles = 0, codeCycles = 0;
+	uint32_t mismatches = 0;
+	int32_t *data;
+	int32_t voltage, current;
+	bool fixedResult, codeResult;
+
+	logUpdateThresholds();
+
+	for (uint8_t pass = 0; pass < BENCH_PASSES; pass++) {
+		start = benchCycles();
+		for (uint16_t i = 0; i < BENCH_FRAMES; i++) {
+			data = getADCConvertedFixed(benchFrames[i]);
+			benchSink = (data[HV_VOLTAGE_CH] >= LOG_HV_VOLTAGE_THRSH_FIXED) +
+					((int64_t)data[HV_VOLTAGE_CH] * data[HV_CURRENT_CH] > MAX_POWER_FIXED || data[HV_VOLTAGE_CH] > MAX_VOLTAGE_FIXED);
+		}
+		fixedCycles += benchCycles() - start;
+
+		start = benchCycles();
+		for (uint16_t i = 0; i < BENCH_FRAMES; i++) {
+			voltage = ADC_FRAME_CODE(benchFrames[i], layout, HV_VOLTAGE_CH);
+			current = ADC_FRAME_CODE(benchFrames[i], layout, HV_CURRENT_CH);
+			benchSink = logStartCondition(voltage, gainTag) + checkRule(voltage, current, gainTag);
+		}
+		codeCycles += benchCycles() - start;
+	}
+
+	for (uint16_t i = 0; i < BENCH_FRAMES; i++) {
+		data = getADCConvertedFixed(benchFrames[i]);
+		voltage = ADC_FRAME_CODE(benchFrames[i], layout, HV_VOLTAGE_CH);
+		current = ADC_FRAME_CODE(benchFrames[i], layout, HV_CURRENT_CH);
+
+		fixedResult = (int64_t)data[HV_VOLTAGE_CH] * data[HV_CURRENT_CH] > MAX_POWER_FIXED || data[HV_VOLTAGE_CH] > MAX_VOLTAGE_FIXED;
+		codeResult = checkRule(voltage, current, gainTag);
+		mismatches += (fixedResult != codeResult) + ((data[HV_VOLTAGE_CH] >= LOG_HV_VOLTAGE_THRSH_FIXED) != logStartCondition(voltage, gainTag));
+	}
+
+	printf("[bench.c]Rules micro-units: %lu cycles/sample\n\r", fixedCycles / (BENCH_FRAMES * BENCH_PASSES));
+	printf("[bench.c]Rules raw codes: %lu cycles/sample\n\r", codeCycles / (BENCH_FRAMES * BENCH_PASSES));
+	printf("[bench.c]Rules mismatches: %lu (bound %d)\n\r", mismatches, BENCH_RULE_MAX_MISMATCH);
+
+	return mismatches <= BENCH_RULE_MAX_MISMATCH;
+}
+
+/* Function      : benchMonitor
+ *
+ * Description   : Measures the compliance monitor cost per sample for several
+ *               window lengths at the burst data rate, where the buckets are
+ *               the longest, then checks the window average and the
+ *               violation timing with a constant power step. The violation
+ *               statistics and the pack estimator are restored afterwards, the
+ *               window starts empty.
+ *
+ * Parameters    : None
+ *
+ * Returns       : true if the average and the violation start are right
+ */
+static bool benchMonitor(void)
+{
+	const uint32_t windows[] = { MONITOR_BUCKET_MS, 100, MONITOR_DEFAULT_WINDOW_MS, MONITOR_BUCKETS * MONITOR_BUCKET_MS };
+	const monitorConfigTypedef saved = *monitorGetConfig();
+	const monitorConfigTypedef step = { 100, 20, BENCH_MONITOR_POWER / 2, MONITOR_DEFAULT_VOLTAGE };
+	uint32_t savedRate = monitorGetRate();
+	monitorConfigTypedef config = saved;
+	monitorSnapshotTypedef snapshot;
+	uint32_t start, cycles;
+	uint32_t seed = 0x2468ACE;
+	uint32_t startSample = 0;
+	int32_t error;
+	bool ended = false;
+
+	monitorSave(&snapshot);
+	monitorSetRate(ADCgetProfileInfo(ADC_PROFILE_BURST)->dataRate);
+
+	for (uint8_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+		config.windowMs = windows[w];
+		monitorConfigure(&config);
+		cycles = 0;
+
+		for (uint16_t i = 0; i < BENCH_FILTER_SAMPLES; i++) {
+			seed = seed * 1664525 + 1013904223;
+
+			start = benchCycles();
+			benchSink = monitorProcess((int32_t)(seed >> 3), (int32_t)seed >> 8);
+			cycles += benchCycles() - start;
+		}
+
+		printf("[bench.c]Monitor window %lu ms: %lu cycles/sample\n\r", windows[w], cycles / BENCH_FILTER_SAMPLES);
+	}
+
+	//constant power above the limit, the violation starts once the duration is covered
+	monitorConfigure(&step);
+	for (uint32_t i = 1; i <= ADCgetProfileInfo(ADC_PROFILE_BURST)->dataRate && startSample == 0; i++) {
+		if (monitorProcess(BENCH_MONITOR_VOLTAGE, BENCH_MONITOR_POWER / (BENCH_MONITOR_VOLTAGE / 1000000) * 1000000) == MONITOR_VIOLATION_START) {
+			startSample = i;
+		}
+	}
+	error = monitorAveragePower() - BENCH_MONITOR_POWER * 1000;
+	error = error < 0 ? -error : error;
+
+	for (uint32_t i = 0; i < ADCgetProfileInfo(ADC_PROFILE_BURST)->dataRate && !ended; i++) {
+		ended = (monitorProcess(BENCH_MONITOR_VOLTAGE, 0) == MONITOR_VIOLATION_END);
+	}
+
+	printf("[bench.c]Monitor step: violation after %lu samples, average error %ld mW, %s\n\r", startSample, error, ended ? "ended" : "not ended");
+
+	monitorConfigure(&saved);
+	monitorSetRate(savedRate);
+	monitorRestore(&snapshot);
+
+	return error <= 1 && ended &&
+			startSample * 1000ULL >= (uint64_t)step.durationMs * ADCgetProfileInfo(ADC_PROFILE_BURST)->dataRate;
+}
+
+/* Function      : benchStats
+ *
+ * Description   : Measures the windowed statistics update cost per sample,
+ *               bucket pushes and cascades included, then checks the shortest
+ *               window against a direct computation over the same samples.
+ *               The session statistics and histograms are restored afterwards,
+ *               the windows start empty.
+ *
+ * Parameters    : None
+ *
+ * Returns       : true if min, max and mean match and the RMS is within
+ *               BENCH_STATS_MAX_RMS_ERROR
+ */
+static bool benchStats(void)
+{
+	uint32_t savedRate = statsGetRate();
+	uint32_t window = BENCH_STATS_RATE * STATS_BUCKET_MS * STATS_BUCKETS / 1000;
+	statsResultTypedef result[STATS_SERIES];
+	int32_t channels[3];
+	uint32_t start, cycles = 0;
+	uint32_t seed = 0x13579BD, windowSeed = 0;
+	int32_t min = INT32_MAX, max = INT32_MIN;
+	int64_t sum = 0, low, high;
+	uint64_t squares = 0;
+	bool rmsOk;
+
+	statsSave(&benchStatsSnapshot);
+	statsSetRate(BENCH_STATS_RATE);
+
+	for (uint32_t i = 0; i < BENCH_STATS_SAMPLES; i++) {
+		if (i == BENCH_STATS_SAMPLES - window) {
+			windowSeed = seed;
+		}
+		for (uint8_t ch = 0; ch < 3; ch++) {
+			seed = seed * 1664525 + 1013904223;
+			channels[ch] = (int32_t)seed >> 4;
+		}
+
+		start = benchCycles();
+		statsProcess(channels);
+		cycles += benchCycles() - start;
+	}
+
+	//the HV voltage samples of the last window, generated again
+	seed = windowSeed;
+	for (uint32_t i = 0; i < window; i++) {
+		for (uint8_t ch = 0; ch < 3; ch++) {
+			seed = seed * 1664525 + 1013904223;
+			channels[ch] = (int32_t)seed >> 4;
+		}
+		min = channels[HV_VOLTAGE_CH] < min ? channels[HV_VOLTAGE_CH] : min;
+		max = channels[HV_VOLTAGE_CH] > max ? channels[HV_VOLTAGE_CH] : max;
+		sum += channels[HV_VOLTAGE_CH];
+		squares += (uint64_t)((int64_t)channels[HV_VOLTAGE_CH] * channels[HV_VOLTAGE_CH]);
+	}
+
+	//the RMS is right if the mean square lies between the squares of its bounds
+	statsGet(0, result);
+	low = result[HV_VOLTAGE_CH].rms - BENCH_STATS_MAX_RMS_ERROR;
+	high = result[HV_VOLTAGE_CH].rms + BENCH_STATS_MAX_RMS_ERROR;
+	rmsOk = (uint64_t)(low * low) <= squares / window && squares / window <= (uint64_t)(high * high);
+
+	printf("[bench.c]Statistics: %lu cycles/sample (%u series, %u windows and session)\n\r", cycles / BENCH_STATS_SAMPLES,
+			STATS_SERIES, STATS_WINDOWS);
+	printf("[bench.c]Statistics check: min %s, max %s, mean %s, RMS %s (bound %d micro-units)\n\r",
+			result[HV_VOLTAGE_CH].min == min ? "OK" : "FAILED", result[HV_VOLTAGE_CH].max == max ? "OK" : "FAILED",
+			result[HV_VOLTAGE_CH].mean == (int32_t)(sum / window) ? "OK" : "FAILED", rmsOk ? "OK" : "FAILED", BENCH_STATS_MAX_RMS_ERROR);
+
+	statsSetRate(savedRate);
+	statsRestore(&benchStatsSnapshot);
+
+	return result[HV_VOLTAGE_CH].min == min && result[HV_VOLTAGE_CH].max == max &&
+			result[HV_VOLTAGE_CH].mean == (int32_t)(sum / window) && rmsOk;
+}
+
+/* Function      : benchRun
+ *
+ * Description   : Runs all the benchmarks and prints the results.
+ *
+ * Parameters    : None
+ *
+ * Returns       : None
+ */
+void benchRun(void)
+{
+	bool pass = true;
+
+	benchCycleCounterInit();
+	benchFillFrames();
+
+	pass &= benchConversion();
+	pass &= benchUnpack();
+	pass &= benchWordLength();
+	pass &= benchFilter();
+	pass &= benchRules();
+	pass &= benchMonitor();
+	pass &= benchStats();
+
+	printf("[bench.c]Benchmarks %s.\n\r", pass ? "PASSED" : "FAILED");
+}
@@ -12,9 +12,11 @@
 #include "eeprom.h"
 #include "string.h"
 
-uint8_t logBuffer[EEPROM_PAGESIZE] = {0x00};
+uint8_t logBuffer[EEPROM_PAGESIZE + EEPROM_RECORD_MAX_SIZE] = {0x00};
 uint16_t dataIndex = 0;
 uint32_t writeAddr = 0;
+uint32_t lastTimestamp = 0;		//timestamp of the previous record, base of the stored delta
+uint8_t logFields = EEPROM_FIELDS_ALL;		//fields of the sample records of the log being written
 
 uint8_t idBuffer[EEPROM_PAGESIZE] = {0x00};
 uint32_t idAddr = 0;
@@ -81,14 +83,207 @@ void clearLogs(void){
 	EEPROM_SPI_WriteID(idBuffer, 0x00000000, (EEPROM_PAGESIZE - (EEPROM_PARAMETERS_SIZE)));
 }
 
+//decodes a varint of the log, returns its size or 0 if it is not complete within size bytes
+static uint8_t EEPROMgetVarint(const uint8_t *data, uint16_t size, uint32_t *value)
+{
+	uint8_t len = 0;
+
+	*value = 0;
+	do {
+		if (len >= size || len >= EEPROM_VARINT_MAX_SIZE) {
+			return 0;
+		}
+		*value |= (uint32_t)(data[len] & 0x7F) << (7 * len);
+	} while (data[len++] & 0x80);
+
+	return len;
+}
+
+/* Function      : EEPROMparseRecord
+ *
+ * Description   : Decodes a log record. Layout records set the fields,
+ *               sample records fill the voltage, current (0 when not in the
+ *               fields) and gains, gap records the first lost sequence and the
+ *               number of lost frames, event records the event and its value.
+ *
+ * Parameters    : data record bytes
+ *               size bytes available at data
+ *               record returns the decoded record, its fields shall hold the
+ *               layout of the log, kept from call to call
+ *
+ * Returns       : record size, 0 if the record is not complete within size
+ */
+static uint8_t EEPROMparseRecord(const uint8_t *data, uint16_t size, EEPROMlogRecordTypedef *record)
+{
+	uint8_t len, field, valueSize;
+	uint32_t key;
+
+	if ((len = EEPROMgetVarint(data, size, &key)) == 0) {
+		return 0;
+	}
+
+	record->type = key & EEPROM_RECORD_TYPE_MASK;
+	record->delta = key >> EEPROM_RECORD_TYPE_BITS;
+
+	if (record->type == EEPROM_RECORD_GAP) {
+		if ((field = EEPROMgetVarint(&data[len], size - len, &record->startSequence)) == 0) {
+			return 0;
+		}
+		len += field;
+		if ((field = EEPROMgetVarint(&data[len], size - len, &record->count)) == 0) {
+			return 0;
+		}
+		return len + field;
+	}
+
+	if (record->type == EEPROM_RECORD_EVENT) {
+		if ((field = EEPROMgetVarint(&data[len], size - len, &record->event)) == 0) {
+			return 0;
+		}
+		len += field;
+		if ((field = EEPROMgetVarint(&data[len], size - len, &record->value)) == 0) {
+			return 0;
+		}
+		return len + field;
+	}
+
+	if (record->type == EEPROM_RECORD_LAYOUT) {
+		if (len + 1 > size) {
+			return 0;
+		}
+		record->fields = data[len] & EEPROM_FIELDS_ALL;
+		return len + 1;
+	}
+
+	valueSize = ((record->fields & EEPROM_FIELD_VOLTAGE) ? 2 : 0) + ((record->fields & EEPROM_FIELD_CURRENT) ? 2 : 0);
+	if (len + valueSize + 1 > size) {
+		return 0;
+	}
+
+	record->voltage = 0;
+	record->current = 0;
+	if (record->fields & EEPROM_FIELD_VOLTAGE) {
+		record->voltage = (data[len] << 8) + data[len+1];
+		len += 2;
+	}
+	if (record->fields & EEPROM_FIELD_CURRENT) {
+		record->current = (data[len] << 8) + data[len+1];
+		len += 2;
+	}
+	record->gains = data[len];
+
+	return len + 1;
+}
+
+/* Function      : EEPROMreadLog
+ *
+ * Description   : Walks the records of a log, optionally sending them through
+ *               the UART. Records may straddle the read chunks, the bytes of
+ *               an incomplete record are carried to the next chunk. Logs not
+ *               opening with a layout record of EEPROM_LOG_FORMAT are skipped,
+ *               the walk stops at a record that cannot be decoded.
+ *
+ * Parameters    : logId log index
+ *               print true to send the records
+ *               fields returns the fields of the log sample records
+ *
+ * Returns       : number of sample, gap and event records in the log
+ */
+static uint32_t EEPROMreadLog(uint8_t logId, bool print, uint8_t *fields)
+{
+	uint8_t logData[EEPROM_PAGESIZE + EEPROM_RECORD_MAX_SIZE];
+	uint16_t held = 0, pos, available, byteQty;
+	uint32_t readAdd = logList[logId].startAddress;
+	uint32_t records = 0;
+	uint64_t timestamp = 0;
+	EEPROMlogRecordTypedef record;
+	uint8_t len;
+
+	record.fields = EEPROM_FIELDS_ALL;
+
+	while (readAdd <= logList[logId].endAddress){
+		byteQty = (readAdd + EEPROM_PAGESIZE) <= logList[logId].endAddress ? EEPROM_PAGESIZE : (logList[logId].endAddress - readAdd + 1);
+		EEPROM_SPI_ReadBuffer(&logData[held], readAdd, byteQty);
+		available = held + byteQty;
+		pos = 0;
+
+		if (readAdd == logList[logId].startAddress && (available < 2 || logData[0] != EEPROM_RECORD_KEY(0, EEPROM_RECORD_LAYOUT) ||
+				(logData[1] & EEPROM_LOG_FORMAT_MASK) != EEPROM_LOG_FORMAT)){
+			if (!print){
+				printf("[eeprom.c]Log %u is not in the record format, skipped.\n\r", logId);
+			}
+			break;
+		}
+		readAdd = readAdd + byteQty;
+
+		while ((len = EEPROMparseRecord(&logData[pos], available - pos, &record)) > 0){
+			pos += len;
+			timestamp += record.delta;
+
+			if (record.type == EEPROM_RECORD_LAYOUT || (record.type == EEPROM_RECORD_EVENT && record.event == EEPROM_EVENT_TIME)){
+				continue;
+			}
+			records++;
+
+			if (!print){
+				continue;
+			}
+
+			if (record.type == EEPROM_RECORD_GAP){
+				printf("$simB4LmL/LD/gap,%lu,%lu\r\n", record.startSequence, record.count);
+				continue;
+			}
+
+			if (record.type == EEPROM_RECORD_EVENT){
+				if (record.event == EEPROM_EVENT_ADC_OUTAGE){
+					printf("$simB4LmL/LD/outage,%lu.%03lu\r\n", record.value / 1000, record.value % 1000);
+				} else if (record.event == EEPROM_EVENT_VIOLATION_START){
+					printf("$simB4LmL/LD/violation_start,%lu\r\n", record.value);
+				} else if (record.event == EEPROM_EVENT_VIOLATION_END){
+					printf("$simB4LmL/LD/violation_end,%lu\r\n", record.value);
+				} else if (record.event == EEPROM_EVENT_PACK_ESTIMATE){
+					printf("$simB4LmL/LD/estimate,%lu.%lu,%lu.%lu\r\n", (record.value >> 16) / 10, (record.value >> 16) % 10,
+							(record.value & 0xFFFF) / 10, (record.value & 0xFFFF) % 10);
+				} else if (record.event >= EEPROM_EVENT_HISTOGRAM){
+					printf("$simB4LmL/LD/histogram,%lu,%lu,%lu\r\n", (record.event - EEPROM_EVENT_HISTOGRAM) / EEPROM_HISTOGRAM_BINS,
+							(record.event - EEPROM_EVENT_HISTOGRAM) % EEPROM_HISTOGRAM_BINS, record.value);
+				} else {
+					printf("$simB4LmL/LD/event,%lu,%lu\r\n", record.event, record.value);
+				}
+				continue;
+			}
+
+			//timestamp in ms with microsecond resolution, then the values the log holds
+			printf("$simB4LmL/LD/%lu.%03lu,", (uint32_t)(timestamp / 1000), (uint32_t)(timestamp % 1000));
+			if (record.fields & EEPROM_FIELD_VOLTAGE){
+				printf("%.2f,", ((float)record.voltage)/100.0);
+			}
+			if (record.fields & EEPROM_FIELD_CURRENT){
+				printf("%.2f,", ((float)record.current)/100.0);
+			}
+			printf("%u,%u,%u\r\n", 1 << ((record.gains >> 4) & 0x07), 1 << (record.gains & 0x07), (record.gains & EEPROM_RECORD_ADC_FAULT) != 0);
+		}
+
+		//an incomplete record is shorter than the longest one, more bytes held is a corrupt record
+		held = available - pos;
+		if (held >= EEPROM_RECORD_MAX_SIZE){
+			if (!print){
+				printf("[eeprom.c]Log %u has a corrupt record at address %lu, read stopped.\n\r", logId, readAdd - held);
+			}
+			break;
+		}
+		memmove(logData, &logData[pos], held);
+	}
+
+	*fields = record.fields;
+
+	return records;
+}
+
 void downloadLogsUART(void){
-	uint8_t logData[EEPROM_PAGESIZE];
-	uint32_t readAdd;
-	uint16_t byteQty;
-	float voltage, current;
-	uint32_t timestamp;
 	char fileName[9];
-	uint32_t totalSamples, samplesSent;
+	uint32_t totalSamples;
+	uint8_t fields;
 
 	EEPROMgetLogMetaData();
 
@@ -96,28 +291,16 @@ void downloadLogsUART(void){
 
 	for (uint8_t i = 0; i<logQty; i++){
 
-		totalSamples = logList[i].size/8;
-		samplesSent = 0;
+		//records have variable size, they are counted first
+		totalSamples = EEPROMreadLog(i, false, &fields);
 
 		sprintf(fileName, "log%02d\r\n", i);
 		printf("$simB4LmL/BOF/%s", fileName); //starting new file
 		printf("$simB4LmL/LD/%lu\r\n", totalSamples + 2); //file header: putting log size in first line
-		printf("$simB4LmL/LD/timestamp,voltage,current\r\n"); //file header: fields label
-
-		readAdd = logList[i].startAddress;
-
-		while (readAdd < logList[i].endAddress){
-			byteQty = (readAdd + EEPROM_PAGESIZE) <= logList[i].endAddress ? EEPROM_PAGESIZE : (logList[i].endAddress - readAdd + 1);
-			EEPROM_SPI_ReadBuffer(logData, readAdd, byteQty);
-			for (uint16_t j = 0; j<EEPROM_PAGESIZE && samplesSent<totalSamples; j+=8){
-				timestamp = (logData[j] << 24) + (logData[j+1] << 16) + (logData[j+2] << 8) + logData[j+3];
-				voltage = ((float)((logData[j+4] << 8) + logData[j+5]))/100.0;
-				current = ((float)((logData[j+6] << 8) + logData[j+7]))/100.0;
-				printf("$simB4LmL/LD/%lu,%.2f,%.2f\r\n", timestamp, voltage, current);
-				samplesSent++;
-			}
-			readAdd = readAdd + byteQty;
-		}
+		printf("$simB4LmL/LD/timestamp,%s%svoltage_gain,current_gain,adc_fault\r\n", (fields & EEPROM_FIELD_VOLTAGE) ? "voltage," : "",
+				(fields & EEPROM_FIELD_CURRENT) ? "current," : ""); //file header: fields label
+
+		EEPROMreadLog(i, true, &fields);
 
 		printf("$simB4LmL/EOF/%s", fileName); //ending file
 	}
@@ -131,7 +314,19 @@ void initIdPage(void)
 	EEPROM_SPI_WriteID(idBuffer, 0x00000000, sizeof(idBuffer)/sizeof(uint8_t));
 }
 
-EepromOperations EEPROMstartLog(void)
+//appends an unsigned LEB128 varint to the log buffer: 7 bits per byte, least
+//significant first, bit 7 set when more bytes follow
+static void EEPROMputVarint(uint32_t value)
+{
+	do {
+		logBuffer[dataIndex] = (value & 0x7F) | (value > 0x7F ? 0x80 : 0x00);
+		dataIndex ++;
+		value >>= 7;
+	} while (value != 0);
+}
+
+//fields lists the sample values the log keeps, EEPROM_FIELD_x
+EepromOperations EEPROMstartLog(uint8_t fields)
 {
 	EepromOperations res = EEPROM_STATUS_COMPLETE;
 
@@ -144,37 +339,24 @@ EepromOperations EEPROMstartLog(void)
 	//sets the start address for the next log to the next memory byte
 	writeAddr = logQty == 0 ? 0 : logList[logQty-1].endAddress + 1;
 	logList[logQty].startAddress = writeAddr;
+	lastTimestamp = 0;
 
 	res = EEPROM_SPI_WriteID((uint8_t*) &logList[logQty].startAddress, (uint32_t)(logQty * 6), 3);
 
+	//the log opens with its layout, the download follows it
+	logFields = fields & EEPROM_FIELDS_ALL;
+	EEPROMputVarint(EEPROM_RECORD_KEY(0, EEPROM_RECORD_LAYOUT));
+	logBuffer[dataIndex] = EEPROM_LOG_FORMAT | logFields;
+	dataIndex ++;
+
 	return res;
 }
 
-EepromOperations EEPROMlogData(uint32_t timestamp, double voltage, double current)
+//writes the log buffer once it reaches the end of the current page
+static EepromOperations EEPROMflushPage(void)
 {
-	uint16_t voltage_int, current_int;
 	EepromOperations res = EEPROM_STATUS_COMPLETE;
 
-	voltage_int = (uint16_t)(voltage*100);
-	current_int = (uint16_t)(current*100);
-
-	logBuffer[dataIndex] = timestamp >> 24;
-	dataIndex ++;
-	logBuffer[dataIndex] = timestamp >> 16;
-	dataIndex ++;
-	logBuffer[dataIndex] = timestamp >> 8;
-	dataIndex ++;
-	logBuffer[dataIndex] = timestamp;
-	dataIndex ++;
-	logBuffer[dataIndex] = voltage_int >> 8;
-	dataIndex ++;
-	logBuffer[dataIndex] = voltage_int;
-	dataIndex ++;
-	logBuffer[dataIndex] = current_int >> 8;
-	dataIndex ++;
-	logBuffer[dataIndex] = current_int;
-	dataIndex ++;
-
 	if (((writeAddr % EEPROM_PAGESIZE) + dataIndex)/EEPROM_PAGESIZE >= 1) {
 
 		printf("[eeprom.c]Writing new page to eeprom address: %lu\n\r", writeAddr);
@@ -189,6 +371,71 @@ EepromOperations EEPROMlogData(uint32_t timestamp, double voltage, double curren
 	return res;
 }
 
+//timestamp in microseconds since the log start, stored as the delta to the previous record.
+//voltage and current are given in micro-units and stored in hundredths, gains packed by EEPROM_RECORD_GAINS
+EepromOperations EEPROMlogData(uint32_t timestamp, int32_t voltage, int32_t current, uint8_t gains)
+{
+	EepromOperations res;
+	uint16_t voltage_int, current_int;
+	uint32_t delta = timestamp - lastTimestamp;
+
+	voltage_int = (uint16_t)(voltage/10000);
+	current_int = (uint16_t)(current/10000);
+	lastTimestamp = timestamp;
+
+	//a delta that does not fit the key is carried by time skip records
+	while (delta > EEPROM_RECORD_DELTA_MAX) {
+		EEPROMputVarint(EEPROM_RECORD_KEY(EEPROM_RECORD_DELTA_MAX, EEPROM_RECORD_EVENT));
+		EEPROMputVarint(EEPROM_EVENT_TIME);
+		EEPROMputVarint(0);
+		delta -= EEPROM_RECORD_DELTA_MAX;
+
+		res = EEPROMflushPage();
+		if (res != EEPROM_STATUS_COMPLETE) {
+			return res;
+		}
+	}
+
+	EEPROMputVarint(EEPROM_RECORD_KEY(delta, EEPROM_RECORD_SAMPLE));
+	if (logFields & EEPROM_FIELD_VOLTAGE) {
+		logBuffer[dataIndex] = voltage_int >> 8;
+		dataIndex ++;
+		logBuffer[dataIndex] = voltage_int;
+		dataIndex ++;
+	}
+	if (logFields & EEPROM_FIELD_CURRENT) {
+		logBuffer[dataIndex] = current_int >> 8;
+		dataIndex ++;
+		logBuffer[dataIndex] = current_int;
+		dataIndex ++;
+	}
+	logBuffer[dataIndex] = gains;
+	dataIndex ++;
+
+	return EEPROMflushPage();
+}
+
+//records that count frames starting at sequence startSequence never reached the log.
+//The gap record does not move the timestamp base
+EepromOperations EEPROMlogGap(uint32_t startSequence, uint32_t count)
+{
+	EEPROMputVarint(EEPROM_RECORD_KEY(0, EEPROM_RECORD_GAP));
+	EEPROMputVarint(startSequence);
+	EEPROMputVarint(count);
+
+	return EEPROMflushPage();
+}
+
+//records an event of the log, EEPROM_EVENT_x. The event record does not move the timestamp base
+EepromOperations EEPROMlogEvent(uint32_t event, uint32_t value)
+{
+	EEPROMputVarint(EEPROM_RECORD_KEY(0, EEPROM_RECORD_EVENT));
+	EEPROMputVarint(event);
+	EEPROMputVarint(value);
+
+	return EEPROMflushPage();
+}
+
 EepromOperations EEPROMendLog(void)
 {
 	EepromOperations res = EEPROM_STATUS_COMPLETE;
@@ -225,6 +472,29 @@ uint8_t *EEPROMextraInfo(void)
 	return &extraInfo[0];
 }
 
+/* Function      : EEPROMwriteParameters
+ *
+ * Description   : Writes to the parameters area of the identification page,
+ *               keeping the RAM copy returned by EEPROMextraInfo up to date.
+ *
+ * Parameters    : data bytes to be written
+ *               offset position inside the parameters area
+ *               size number of bytes
+ *
+ * Returns       : EEPROM operation status
+ */
+EepromOperations EEPROMwriteParameters(const uint8_t *data, uint16_t offset, uint16_t size)
+{
+	if (offset + size > EEPROM_PARAMETERS_SIZE) {
+		return EEPROM_STATUS_ERROR;
+	}
+
+	memcpy(&extraInfo[offset], data, size);
+	memcpy(&idBuffer[(3 * EEPROM_MAX_LOG) + offset], data, size);
+
+	return EEPROM_SPI_WriteID(&extraInfo[offset], (3 * EEPROM_MAX_LOG) + offset, size);
+}
+
 EepromOperations EEPROMreadData(uint8_t* dataBuffer, uint32_t address, uint32_t size)
 {
 	EepromOperations res = EEPROM_STATUS_COMPLETE;
@@ -237,6 +507,12 @@ EepromOperations EEPROMreadData(uint8_t* dataBuffer, uint32_t address, uint32_t
 	return res;
 }
 
+//logs in the index, the last one ended has the id EEPROMlogCount() - 1
+uint32_t EEPROMlogCount(void)
+{
+	return logQty;
+}
+
 void getLogInfo(uint32_t logId, uint32_t* startAddress, uint32_t* endAddress, uint32_t* size)
 {
 	// The EndLog routine shall be called before the getLogInfo function to make
@@ -476,23 +476,24 @@ uint8_t EEPROM_SPI_WaitStandbyState(void)
 	uint8_t sEEstatus[1] = { 0x00 };
 	uint8_t command[1] = { EEPROM_RDSR };
 
-	// Select the EEPROM: Chip Select low
-	EEPROM_CS_LOW();
-
-	// Send "Read Status Register" instruction
-	EEPROM_SPI_SendInstruction((uint8_t*)command, 1);
-
-	// Loop as long as the memory is busy with a write cycle
+	// Loop as long as the memory is busy with a write cycle. The status is
+	// read in short transactions so the bus is free for the ADC frames during
+	// the internal write cycle.
 	do {
+		// Select the EEPROM: Chip Select low
+		EEPROM_CS_LOW();
+
+		// Send "Read Status Register" instruction
+		EEPROM_SPI_SendInstruction((uint8_t*)command, 1);
 
 		while (HAL_SPI_Receive(EEPROM_SPI, (uint8_t*)sEEstatus, 1, 200) == HAL_BUSY) {
 
 		};
 
-	} while ((sEEstatus[0] & EEPROM_WIP_FLAG) == SET); // Write in progress
+		// Deselect the EEPROM: Chip Select high
+		EEPROM_CS_HIGH();
 
-	// Deselect the EEPROM: Chip Select high
-	EEPROM_CS_HIGH();
+	} while ((sEEstatus[0] & EEPROM_WIP_FLAG) == SET); // Write in progress
 
 	return 0;
 }
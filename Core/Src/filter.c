@@ -0,0 +1,190 @@
+/*******************************************************************************
+  * File Name			: filter.c
+  * Description			: This module implements the low-pass filter and
+  * 					  decimation stage between the converted samples and the
+  * 					  log. Each channel goes through a third order CIC
+  * 					  decimator and a droop compensated FIR decimating by 2,
+  * 					  computed with the dual 16-bit MAC (SMLAD).
+  *
+  * Date				: October 17, 2026
+  ******************************************************************************
+  */
+
+#include "filter.h"
+#include "adc.h"
+#include <string.h>
+
+#if (FILTER_FIR_TAPS % 4) != 0
+#error "FILTER_FIR_TAPS must be a multiple of 4"
+#endif
+
+//windowed frequency sampling design, flat within 0.5 dB up to 0.15 of the CIC
+//output rate including the CIC droop, -42 dB from 0.3, DC gain 1.0
+static const int16_t filterTaps[FILTER_FIR_TAPS] __ALIGNED(4) = {
+	0, -1, 3, 26, 12, -137, -182, 341, 857, -287, -2523, -1344, 5901, 13718,
+	13718, 5901, -1344, -2523, -287, 857, 341, -182, -137, 12, 26, 3, -1, 0
+};
+
+static const int32_t filterStep[FILTER_CHANNELS] = {
+	[SUPPLY_CURRENT_CH] = FILTER_STEP_SUPPLY_CURRENT,
+	[HV_CURRENT_CH] = FILTER_STEP_HV_CURRENT,
+	[HV_VOLTAGE_CH] = FILTER_STEP_HV_VOLTAGE,
+};
+
+typedef struct {
+	uint64_t integrator[FILTER_CIC_ORDER];
+	uint64_t comb[FILTER_CIC_ORDER];
+	int16_t delay[2 * FILTER_FIR_TAPS] __ALIGNED(4);	//written twice so the window is always contiguous
+} filterChannelTypedef;
+
+filterChannelTypedef filterChannel[FILTER_CHANNELS];
+uint32_t filterInputRate = 0;
+uint16_t filterOutputRate = FILTER_DEFAULT_RATE;
+uint32_t filterCicDecimation = 1;
+int64_t filterCicGain = 1;			//R^3
+uint32_t filterCicCount = 0;
+uint8_t filterDelayPos = 0;
+
+/* Function      : filterConfigure
+ *
+ * Description   : Sets the decimation for an input and output rate and clears
+ *               the filter state. The CIC decimation is the one that brings
+ *               the rate closest to twice the output rate.
+ *
+ * Parameters    : inputRate converted samples per second
+ *               outputRate filtered samples per second
+ *
+ * Returns       : None
+ */
+void filterConfigure(uint32_t inputRate, uint16_t outputRate)
+{
+	uint32_t decimation;
+
+	if (outputRate == 0) {
+		outputRate = FILTER_DEFAULT_RATE;
+	}
+
+	decimation = (inputRate + outputRate) / (FILTER_FIR_DECIMATION * outputRate);
+	decimation = decimation < 1 ? 1 : decimation;
+	decimation = decimation > FILTER_CIC_MAX_DECIMATION ? FILTER_CIC_MAX_DECIMATION : decimation;
+
+	filterInputRate = inputRate;
+	filterOutputRate = outputRate;
+	filterCicDecimation = decimation;
+	filterCicGain = (int64_t)decimation * decimation * decimation;
+	filterCicCount = 0;
+	filterDelayPos = 0;
+	memset(filterChannel, 0, sizeof(filterChannel));
+}
+
+//reads two consecutive Q15 values as one word, the SMLAD operand
+__STATIC_FORCEINLINE uint32_t filterReadPair(const int16_t *p)
+{
+	uint32_t pair;
+
+	memcpy(&pair, p, sizeof(pair));
+
+	return pair;
+}
+
+/* Function      : filterFir
+ *
+ * Description   : Computes the FIR output of a channel over its delay line,
+ *               two taps per SMLAD.
+ *
+ * Parameters    : window newest FIR_TAPS samples, word aligned
+ *
+ * Returns       : Q15 accumulated output, in steps
+ */
+static int32_t filterFir(const int16_t *window)
+{
+	int32_t acc = 0;
+
+	for (uint8_t i = 0; i < FILTER_FIR_TAPS; i += 4) {
+		acc = __SMLAD(filterReadPair(&window[i]), filterReadPair(&filterTaps[i]), acc);
+		acc = __SMLAD(filterReadPair(&window[i + 2]), filterReadPair(&filterTaps[i + 2]), acc);
+	}
+
+	return acc;
+}
+
+/* Function      : filterProcess
+ *
+ * Description   : Feeds one converted sample of every channel to the filter.
+ *               The CIC integrators run at the input rate, the combs and the
+ *               FIR only when a decimated sample is due.
+ *
+ * Parameters    : input converted channels, micro-units
+ *               output filtered channels, micro-units, written when ready
+ *
+ * Returns       : true when a filtered sample was written to output
+ */
+bool filterProcess(const int32_t *input, int32_t *output)
+{
+	filterChannelTypedef *ch;
+	uint64_t value, previous;
+	int64_t cic, divider;
+	bool ready;
+
+	for (uint8_t i = 0; i < FILTER_CHANNELS; i++) {
+		ch = &filterChannel[i];
+		ch->integrator[0] += (uint64_t)(int64_t)input[i];
+		ch->integrator[1] += ch->integrator[0];
+		ch->integrator[2] += ch->integrator[1];
+	}
+
+	if (++filterCicCount < filterCicDecimation) {
+		return false;
+	}
+	filterCicCount = 0;
+
+	filterDelayPos = (filterDelayPos == 0) ? FILTER_FIR_TAPS - 1 : filterDelayPos - 1;
+	ready = ((filterDelayPos & (FILTER_FIR_DECIMATION - 1)) == 0);
+
+	for (uint8_t i = 0; i < FILTER_CHANNELS; i++) {
+		ch = &filterChannel[i];
+
+		value = ch->integrator[FILTER_CIC_ORDER - 1];
+		for (uint8_t j = 0; j < FILTER_CIC_ORDER; j++) {
+			previous = ch->comb[j];
+			ch->comb[j] = value;
+			value = value - previous;
+		}
+
+		//CIC gain removed and scaled to FIR steps, saturated to 16 bits
+		divider = filterCicGain * filterStep[i];
+		cic = (int64_t)value;
+		cic = (cic + (cic >= 0 ? divider / 2 : -divider / 2)) / divider;
+		cic = cic > INT16_MAX ? INT16_MAX : (cic < INT16_MIN ? INT16_MIN : cic);
+		ch->delay[filterDelayPos] = (int16_t)cic;
+		ch->delay[filterDelayPos + FILTER_FIR_TAPS] = (int16_t)cic;
+
+		if (ready) {
+			output[i] = (int32_t)(((int64_t)filterFir(&ch->delay[filterDelayPos]) * filterStep[i] + (1 << (FILTER_Q15_SHIFT - 1))) >> FILTER_Q15_SHIFT);
+		}
+	}
+
+	return ready;
+}
+
+uint32_t filterGetInputRate(void)
+{
+	return filterInputRate;
+}
+
+uint16_t filterGetOutputRate(void)
+{
+	return filterOutputRate;
+}
+
+//input samples per filtered sample
+uint32_t filterGetDecimation(void)
+{
+	return filterCicDecimation * FILTER_FIR_DECIMATION;
+}
+
+//delay of the filtered samples, in input samples
+uint32_t filterGetGroupDelay(void)
+{
+	return (FILTER_CIC_ORDER * (filterCicDecimation - 1)) / 2 + (filterCicDecimation * (FILTER_FIR_TAPS - 1)) / 2;
+}
@@ -11,8 +11,11 @@
 #include "integrity.h"
 #include "ui.h"
 #include "power.h"
+#include "adc_spi.h"
+#include "adc.h"
 
 static ERROR_CODES currentStatus;
+static ADChealthTypedef adcHealthSeen;
 
 /* Function      : setCurrentStatus
  *
@@ -74,6 +77,39 @@ void goToErrorMode(ERROR_CODES error)
 }
 
 
+/* Function      : checkAdcHealth
+ *
+ * Description   : Raises the integrity events of the ADC health counters
+ *               that moved since the last call. A reset or a register map
+ *               that no longer matches the configuration gets the
+ *               configuration replayed.
+ *
+ * Parameters    : None.
+ *
+ * Returns		 : None.
+ */
+static void checkAdcHealth(void)
+{
+	const ADChealthTypedef *health = ADCgetHealth();
+
+	if (health->resets != adcHealthSeen.resets) {
+		goToErrorMode(ADC_RESET_ERROR);
+		ADCrequestRecovery();
+	} else if (health->regmapChanges != adcHealthSeen.regmapChanges) {
+		//the flag is also raised by the register writes, only a mismatch is a fault
+		if (ADCcheckRegisters() != HAL_OK) {
+			goToErrorMode(ADC_REGMAP_CRC_ERROR);
+			ADCrequestRecovery();
+		}
+	}
+
+	if (health->inputCrcErrors != adcHealthSeen.inputCrcErrors) {
+		goToErrorMode(ADC_INPUT_CRC_ERROR);
+	}
+
+	adcHealthSeen = *health;
+}
+
 /* Function      : houseKeep
  *
  * Description   : Calls periodic routines that must be executed to
@@ -87,4 +123,14 @@ void goToErrorMode(ERROR_CODES error)
 void houseKeep(void)
 {
 	checkPowerEnState();
+
+	//keeps the cycle counter extension running while no samples are timestamped
+	timebaseMicros();
+
+	//resets the ADC when its frames stop or its STATUS reports a reset
+	checkAdcHealth();
+	ADCwatchdog();
+
+	//sleeps while parked, until the ADC sees HV current or voltage
+	checkStandby();
 }
@@ -18,26 +18,62 @@ uint32_t samplesAcquired = 0;
 uint16_t samplesToLog = 0;
 uint32_t logStartTimestamp = 0;
 bool logEndRequested = false;
+logStatsTypedef logStats = {0};
+uint32_t logNextSequence = 0;		//sequence expected from the next sample
+bool logSequenceValid = false;
+uint32_t logGapStart = 0;			//gap detected before the sample being added
+uint32_t logGapCount = 0;
+uint32_t logOutageSeen = 0;			//ADC outages already accounted
+uint32_t logOutage = 0;				//outage before the sample being added, us
+logRulesTypedef logRules = {0};
+monitorEvent logEvent = MONITOR_NO_EVENT;	//monitor event at the sample being added
+uint32_t logEventValue = 0;
+
+//event record of every monitor event
+static const uint8_t logEventCodes[] = {
+	[MONITOR_VIOLATION_START] = EEPROM_EVENT_VIOLATION_START,
+	[MONITOR_VIOLATION_END] = EEPROM_EVENT_VIOLATION_END,
+	[MONITOR_ESTIMATE] = EEPROM_EVENT_PACK_ESTIMATE,
+};
 
 //initializes the log buffer, resets buffer head and tail and sets the flag that indicates if it's logging
 void logStart(void){
 
+	uint8_t layoutMask;
+
 	bufferHead = 0;
 	bufferTail = 0;
 
 	for (uint8_t i = 0; i < HS_BUFFER_SIZE; i++){
-		dataLogBuffer[i].current = 0.0;
-		dataLogBuffer[i].voltage = 0.0;
+		dataLogBuffer[i].current = 0;
+		dataLogBuffer[i].voltage = 0;
 		dataLogBuffer[i].directive = PENDING;
 		dataLogBuffer[i].ruleVoided = false;
 		dataLogBuffer[i].timestamp = 0;
+		dataLogBuffer[i].gains = 0;
+		dataLogBuffer[i].filtered = false;
+		dataLogBuffer[i].gapCount = 0;
+		dataLogBuffer[i].outage = 0;
+		dataLogBuffer[i].event = MONITOR_NO_EVENT;
 	}
 
-	EEPROMstartLog();
+	//frames lost before the log started are only counted
+	logGapCount = 0;
+	logOutage = 0;
+	logEvent = MONITOR_NO_EVENT;
+	logEndRequested = false;
+	monitorEnergyReset();
+	statsReset();
+
+	//the log keeps the HV channels enabled in the frame layout
+	layoutMask = ADCgetLayout()->channelMask;
+	EEPROMstartLog(((layoutMask & (1 << HV_VOLTAGE_CH)) ? EEPROM_FIELD_VOLTAGE : 0) |
+			((layoutMask & (1 << HV_CURRENT_CH)) ? EEPROM_FIELD_CURRENT : 0));
 
 	isLogging = true;
 
-	printf("[log.c]Log started.\n\r");
+	printf("[log.c]Log started, %lu SPS, low speed %u SPS (decimation %lu, delay %lu samples).\n\r", ADCgetProfileInfo(ADCgetProfile())->dataRate,
+			filterGetOutputRate(), filterGetDecimation(), filterGetGroupDelay());
 }
 
 void requestLogEnd(){
@@ -48,20 +84,67 @@ bool isLoggingOn(){
 	return isLogging;
 }
 
-bool checkRule(double voltage, double current){
+/* Function      : logUpdateThresholds
+ *
+ * Description   : Converts the rule and trigger thresholds into raw codes and
+ *               code products for every PGA setting. The codes are calibrated
+ *               inside the ADC, so the tables only depend on the scale
+ *               factors and are computed once.
+ *
+ * Parameters    : None
+ *
+ * Returns       : None
+ */
+void logUpdateThresholds(void){
+
+	int64_t voltageScale, currentScale;
 	double power;
-	power = voltage * current;
-	if (power > MAX_POWER){
+
+	for (uint8_t v = 0; v < ADC_GAIN_QTY; v++){
+		logRules.startVoltage[v] = ADCcodeFromFixedGain(HV_VOLTAGE_CH, LOG_HV_VOLTAGE_THRSH_FIXED, v);
+		logRules.maxVoltage[v] = ADCcodeFromFixedGain(HV_VOLTAGE_CH, MAX_VOLTAGE_FIXED, v);
+		voltageScale = ADCgetScale(HV_VOLTAGE_CH, v);
+
+		for (uint8_t c = 0; c < ADC_GAIN_QTY; c++){
+			currentScale = ADCgetScale(HV_CURRENT_CH, c);
+
+			//power = code product * scale product / 2^(2 * ADC_SCALE_SHIFT)
+			power = (double)MAX_POWER_FIXED * (double)(1ULL << ADC_SCALE_SHIFT) * (double)(1ULL << ADC_SCALE_SHIFT) /
+					((double)voltageScale * (double)currentScale);
+			power = power < 0 ? -power : power;
+
+			logRules.maxPower[v][c] = (voltageScale == 0 || currentScale == 0 || power >= (double)INT64_MAX) ? INT64_MAX : (int64_t)power;
+		}
+	}
+
+	logRules.negateCurrent = (ADCgetScale(HV_CURRENT_CH, 0) < 0) != (ADCgetScale(HV_VOLTAGE_CH, 0) < 0);
+	logRules.valid = true;
+}
+
+//evaluates the rules on raw codes with the thresholds of the gains they were converted with,
+//one 32x32->64 multiply
+bool checkRule(int32_t voltageCode, int32_t currentCode, uint16_t gainTag){
+	uint8_t voltageGain = ADC_GAIN_TAG_GAIN(gainTag, HV_VOLTAGE_CH);
+	int64_t power;
+
+	currentCode = logRules.negateCurrent ? -currentCode : currentCode;
+	power = (int64_t)voltageCode * currentCode;
+	if (power > logRules.maxPower[voltageGain][ADC_GAIN_TAG_GAIN(gainTag, HV_CURRENT_CH)]){
 		return true;
 	}
 
-	if (voltage > MAX_VOLTAGE){
+	if (voltageCode > logRules.maxVoltage[voltageGain]){
 		return true;
 	}
 
 	return false;
 }
 
+//log trigger, the HV voltage is at or above LOG_HV_VOLTAGE_THRSH
+bool logStartCondition(int32_t voltageCode, uint16_t gainTag){
+	return voltageCode >= logRules.startVoltage[ADC_GAIN_TAG_GAIN(gainTag, HV_VOLTAGE_CH)];
+}
+
 uint8_t bufferSize(void){
 
 	if(bufferHead != bufferTail)
@@ -79,14 +162,42 @@ uint8_t bufferSize(void){
 	return 0;
 }
 
-void addToBuffer(uint32_t timestamp, double voltage, double current){
+//keeps the samples at which the decimation filter gave an output, logging the filtered values
+logDirective lowSpeedDirective(logElementTypedef *element){
+
+	if (element->filtered){
+		element->voltage = element->filteredVoltage;
+		element->current = element->filteredCurrent;
+		return LOG;
+	}
+
+	return DONOTLOG;
+}
+
+void addToBuffer(uint32_t timestamp, int32_t voltage, int32_t current, uint8_t gains, const int32_t *filtered, bool ruleVoided){
 
 	uint8_t i;
 
 	dataLogBuffer[bufferHead].current = current;
 	dataLogBuffer[bufferHead].voltage = voltage;
 	dataLogBuffer[bufferHead].timestamp = timestamp;
-	dataLogBuffer[bufferHead].ruleVoided = checkRule(voltage, current);
+	dataLogBuffer[bufferHead].gains = gains;
+	dataLogBuffer[bufferHead].filtered = (filtered != NULL);
+	if (filtered != NULL){
+		dataLogBuffer[bufferHead].filteredVoltage = filtered[HV_VOLTAGE_CH];
+		dataLogBuffer[bufferHead].filteredCurrent = filtered[HV_CURRENT_CH];
+	}
+	dataLogBuffer[bufferHead].gapStart = logGapStart;
+	dataLogBuffer[bufferHead].gapCount = logGapCount;
+	logGapCount = 0;
+	dataLogBuffer[bufferHead].outage = logOutage;
+	logOutage = 0;
+	dataLogBuffer[bufferHead].event = logEvent;
+	dataLogBuffer[bufferHead].eventValue = logEventValue;
+	logEvent = MONITOR_NO_EVENT;
+	//the start and the end of a violation are kept with the samples around them
+	dataLogBuffer[bufferHead].ruleVoided = ruleVoided || (dataLogBuffer[bufferHead].event == MONITOR_VIOLATION_START) ||
+			(dataLogBuffer[bufferHead].event == MONITOR_VIOLATION_END);
 
 	if(dataLogBuffer[bufferHead].ruleVoided){ //if any rule is voided, it marks all samples from tail to head as LOG
 
@@ -104,7 +215,7 @@ void addToBuffer(uint32_t timestamp, double voltage, double current){
 		samplesToLog = HS_LOG_SAMPLE_QTY/2; //sets samplesToLog so the next samples are marked as LOG immediately
 
 		printf("[log.c]Rule voided:\n\r");
-		printf("[log.c]Voltage = %.2f | Current = %.2f\n\r", dataLogBuffer[bufferHead].voltage, dataLogBuffer[bufferHead].current);
+		printf("[log.c]Voltage = %.2f | Current = %.2f\n\r", ADC_FIXED_TO_DOUBLE(dataLogBuffer[bufferHead].voltage), ADC_FIXED_TO_DOUBLE(dataLogBuffer[bufferHead].current));
 
 	} else if (samplesToLog > 0){
 
@@ -118,11 +229,7 @@ void addToBuffer(uint32_t timestamp, double voltage, double current){
 	}
 
 	if (bufferSize() >= HS_LOG_SAMPLE_QTY/2 && dataLogBuffer[bufferTail].directive == PENDING){
-		if (bufferTail % LS_LOG_SAMPLE_INTERVAL == 0){
-			dataLogBuffer[bufferTail].directive = LOG;
-		} else {
-			dataLogBuffer[bufferTail].directive = DONOTLOG;
-		}
+		dataLogBuffer[bufferTail].directive = lowSpeedDirective(&dataLogBuffer[bufferTail]);
 	}
 
 	bufferHead = (++bufferHead == HS_BUFFER_SIZE) ? 0 : bufferHead;
@@ -133,18 +240,178 @@ void addToBuffer(uint32_t timestamp, double voltage, double current){
 }
 
 void logToMemory(void){
+	uint32_t written = 0;
+
 	while (dataLogBuffer[bufferTail].directive != PENDING && bufferTail != bufferHead){
+
+		//outages and gaps are recorded whether or not the sample after them is kept
+		if (dataLogBuffer[bufferTail].outage > 0){
+			if (EEPROMlogEvent(EEPROM_EVENT_ADC_OUTAGE, dataLogBuffer[bufferTail].outage) != EEPROM_STATUS_COMPLETE){
+				logStats.storeErrors++;
+			}
+			dataLogBuffer[bufferTail].outage = 0;
+			written++;
+		}
+
+		if (dataLogBuffer[bufferTail].gapCount > 0){
+			if (EEPROMlogGap(dataLogBuffer[bufferTail].gapStart, dataLogBuffer[bufferTail].gapCount) != EEPROM_STATUS_COMPLETE){
+				logStats.storeErrors++;
+			}
+			logStats.gapRecords++;
+			dataLogBuffer[bufferTail].gapCount = 0;
+			written++;
+		}
+
+		if (dataLogBuffer[bufferTail].event != MONITOR_NO_EVENT){
+			if (EEPROMlogEvent(logEventCodes[dataLogBuffer[bufferTail].event], dataLogBuffer[bufferTail].eventValue) != EEPROM_STATUS_COMPLETE){
+				logStats.storeErrors++;
+			}
+			dataLogBuffer[bufferTail].event = MONITOR_NO_EVENT;
+			written++;
+		}
+
 		if (dataLogBuffer[bufferTail].directive == LOG){
 
-			EEPROMlogData(dataLogBuffer[bufferTail].timestamp, dataLogBuffer[bufferTail].voltage, dataLogBuffer[bufferTail].current);
+			if (EEPROMlogData(dataLogBuffer[bufferTail].timestamp, dataLogBuffer[bufferTail].voltage, dataLogBuffer[bufferTail].current, dataLogBuffer[bufferTail].gains) != EEPROM_STATUS_COMPLETE){
+				logStats.storeErrors++;
+			}
+			logStats.recordsLogged++;
+			written++;
 
 			dataLogBuffer[bufferTail].directive = LOGGED;
 
 			printf("[log.c]Data logged:\n\r");
-			printf("[log.c]Voltage = %.2f | Current = %.2f\n\r", dataLogBuffer[bufferTail].voltage, dataLogBuffer[bufferTail].current);
+			printf("[log.c]Voltage = %.2f | Current = %.2f\n\r", ADC_FIXED_TO_DOUBLE(dataLogBuffer[bufferTail].voltage), ADC_FIXED_TO_DOUBLE(dataLogBuffer[bufferTail].current));
 		}
 		bufferTail = (++bufferTail == HS_BUFFER_SIZE) ? 0 : bufferTail;
 	}
+
+	if (written > logStats.backlogHighWater){
+		logStats.backlogHighWater = written;
+	}
+}
+
+/* Function      : logCheckSequence
+ *
+ * Description   : Compares the sequence number of a sample with the expected
+ *               one. A break is counted and, while logging, kept to be
+ *               written as a gap record before the sample.
+ *
+ * Parameters    : sequence sequence number of the sample
+ *
+ * Returns       : None
+ */
+static void logCheckSequence(uint32_t sequence){
+
+	uint32_t lost = sequence - logNextSequence;
+
+	if (logSequenceValid && lost != 0){
+		logStats.gaps++;
+		logStats.framesLost += lost;
+
+		if (isLogging){
+			if (logGapCount == 0){
+				logGapStart = logNextSequence;
+			}
+			logGapCount += lost;
+		}
+	}
+
+	logSequenceValid = true;
+	logNextSequence = sequence + 1;
+	logStats.framesProcessed++;
+}
+
+/* Function      : logCheckOutage
+ *
+ * Description   : Picks up the ADC outages recovered by the DRDY watchdog. An
+ *               outage is kept, while logging, to be written as an event
+ *               record before the first sample taken after the recovery.
+ *
+ * Parameters    : sequence sequence number of the sample
+ *
+ * Returns       : None
+ */
+static void logCheckOutage(uint32_t sequence){
+
+	const ADCoutageTypedef *outage = ADCgetOutage();
+
+	if (outage->count == logOutageSeen || (int32_t)(sequence - outage->resumeSequence) < 0){
+		return;
+	}
+
+	logOutageSeen = outage->count;
+
+	if (isLogging){
+		logOutage += outage->duration;
+	}
+}
+
+/* Function      : logCheckMonitor
+ *
+ * Description   : Feeds the FSAE compliance monitor. A violation start or end
+ *               is kept, while logging, to be written as an event record
+ *               before the sample and to trigger the log like a voided rule.
+ *               The periodic pack estimate is kept the same way on samples
+ *               without a violation event.
+ *
+ * Parameters    : voltage HV voltage, uV
+ *               current HV current, uA
+ *
+ * Returns       : None
+ */
+static void logCheckMonitor(int32_t voltage, int32_t current){
+
+	monitorEvent event = monitorProcess(voltage, current);
+	const monitorEstimateTypedef *estimate;
+	float ocv, resistance;
+	int32_t power;
+
+	if (event == MONITOR_NO_EVENT){
+		if (isLogging && monitorEstimateDue()){
+			estimate = monitorGetEstimate();
+			ocv = estimate->ocv * 10.0f;
+			resistance = estimate->resistance * 10000.0f;
+			logEvent = MONITOR_ESTIMATE;
+			logEventValue = EEPROM_ESTIMATE_VALUE(ocv < 0 ? 0 : (ocv > 0xFFFF ? 0xFFFF : (uint32_t)ocv),
+					resistance < 0 ? 0 : (resistance > 0xFFFF ? 0xFFFF : (uint32_t)resistance));
+		}
+		return;
+	}
+
+	if (event == MONITOR_VIOLATION_START){
+		power = monitorAveragePower() / 1000;
+		logEventValue = power > 0 ? power : 0;
+		printf("[log.c]FSAE limit violation, %ld W | %.2f V average.\n\r", power, ADC_FIXED_TO_DOUBLE(monitorAverageVoltage()));
+	} else {
+		logEventValue = monitorGetStats()->lastDuration;
+		printf("[log.c]FSAE limit violation ended after %lu ms.\n\r", logEventValue);
+	}
+
+	if (isLogging){
+		logEvent = event;
+	}
+}
+
+void logGetStats(logStatsTypedef *stats){
+	*stats = logStats;
+	stats->framesAcquired = ADCsequenceCount();
+}
+
+//writes the session histograms at the end of the log, one event record per bin with samples
+static void logHistograms(void){
+
+	const uint32_t *histogram;
+
+	for (uint8_t h = 0; h < STATS_HIST_QTY; h++){
+		histogram = statsGetHistogram(h);
+
+		for (uint8_t bin = 0; bin < STATS_HIST_BINS; bin++){
+			if (histogram[bin] > 0 && EEPROMlogEvent(EEPROM_HISTOGRAM_EVENT(h, bin), histogram[bin]) != EEPROM_STATUS_COMPLETE){
+				logStats.storeErrors++;
+			}
+		}
+	}
 }
 
 void logEnd(void){
@@ -153,49 +420,100 @@ void logEnd(void){
 
 	while (i != bufferTail - 1){
 		if (dataLogBuffer[bufferTail].directive == PENDING){
-			if (bufferTail % LS_LOG_SAMPLE_INTERVAL == 0){
-				dataLogBuffer[bufferTail].directive = LOG;
-			} else {
-				dataLogBuffer[bufferTail].directive = DONOTLOG;
-			}
+			dataLogBuffer[bufferTail].directive = lowSpeedDirective(&dataLogBuffer[bufferTail]);
 		}
 		i = (i == 0) ? (HS_BUFFER_SIZE - 1) : i - 1;
 	}
 
 	logToMemory();
+	logHistograms();
 
-	EEPROMendLog();
+	if (EEPROMendLog() == EEPROM_STATUS_COMPLETE){
+		monitorSaveEnergy(EEPROMlogCount() - 1);
+	}
 
 	isLogging = false;
+	logEndRequested = false;
 	printf("[log.c]Log ended.\n\r");
 }
 
-void dataLogRoutine(uint32_t timestamp, uint8_t *ADCnewData){
-
-	double *ADCConvertedData = NULL;
-
-	if (*ADCnewData){
+//drains the sample queue in batches of up to LOG_DRAIN_BATCH samples, so the
+//samples acquired during a slow EEPROM write are all processed afterwards.
+//Every sample goes through the decimation filter, which feeds the low speed log
+void dataLogRoutine(void){
+
+	int32_t *ADCConvertedData = NULL;
+	const int32_t *codes;
+	int32_t filtered[FILTER_CHANNELS];
+	bool filterReady;
+	uint32_t dataRate = ADCgetProfileInfo(ADCgetProfile())->dataRate;
+	sampleTypedef *sample;
+	uint32_t timestamp;
+	uint16_t gainTag;
+	bool adcFault;
+	bool voltageOn;
+	uint8_t processed = 0;
+
+	if (!logRules.valid){
+		logUpdateThresholds();
+	}
 
-		ADCConvertedData = getADCConvertedData();
+	//the decimation follows the ADC data rate profile
+	if (filterGetInputRate() != dataRate){
+		filterConfigure(dataRate, filterGetOutputRate());
+	}
+	if (monitorGetRate() != dataRate){
+		monitorSetRate(dataRate);
+	}
+	if (statsGetRate() != dataRate){
+		statsSetRate(dataRate);
+	}
 
-		if (!isLogging && ADCConvertedData[HV_VOLTAGE_CH] >= LOG_HV_VOLTAGE_THRSH){
+	while (processed < LOG_DRAIN_BATCH && (sample = sampleQueuePeek()) != NULL){
+
+		timestamp = sample->timestamp;
+		logCheckSequence(sample->sequence);
+		logCheckOutage(sample->sequence);
+		adcFault = ADCdecodeStatus(sample->frame, sample->response);
+		ADCConvertedData = getADCConvertedFixedTagged(sample->frame, sample->gainTag);
+		ADCautoRange(sample->frame, sample->gainTag);
+		sampleQueueRelease();
+		gainTag = getADCConvertedGainTag();
+		codes = getADCConvertedCodes();
+		filterReady = filterProcess(ADCConvertedData, filtered);
+		statsProcess(ADCConvertedData);
+		processed++;
+
+		//trigger and rules on the raw codes, the micro-units are only kept for storage
+		voltageOn = logStartCondition(codes[HV_VOLTAGE_CH], gainTag);
+
+		if (!isLogging && voltageOn){
 			printf("[log.c]Starting log.\n\r");
 			logStart();
 			logStartTimestamp = timestamp;
 		}
 
+		logCheckMonitor(ADCConvertedData[HV_VOLTAGE_CH], ADCConvertedData[HV_CURRENT_CH]);
+		monitorIntegrate(ADCConvertedData[HV_VOLTAGE_CH], ADCConvertedData[HV_CURRENT_CH], timestamp);
+
 		if (isLogging) {
-			addToBuffer((timestamp - logStartTimestamp), ADCConvertedData[HV_VOLTAGE_CH], ADCConvertedData[HV_CURRENT_CH]);
-			logToMemory();
+			addToBuffer((timestamp - logStartTimestamp), ADCConvertedData[HV_VOLTAGE_CH], ADCConvertedData[HV_CURRENT_CH],
+					EEPROM_RECORD_GAINS(ADC_GAIN_TAG_GAIN(gainTag, HV_VOLTAGE_CH), ADC_GAIN_TAG_GAIN(gainTag, HV_CURRENT_CH)) | (adcFault * EEPROM_RECORD_ADC_FAULT),
+					filterReady ? filtered : NULL, checkRule(codes[HV_VOLTAGE_CH], codes[HV_CURRENT_CH], gainTag));
 
-			if (ADCConvertedData[HV_VOLTAGE_CH] < LOG_HV_VOLTAGE_THRSH){
+			if (!voltageOn){
 				printf("[log.c]Ending log.\n\r");
 				logEnd();
 			}
 		}
+	}
+
+	if (processed > 0 && isLogging){
+		logToMemory();
+	}
 
-		*ADCnewData = 0;
-	} else if (logEndRequested && isLogging){
+	//checked after every batch, the queue may never empty at the fastest profiles
+	if (logEndRequested && isLogging){
 		printf("[log.c]Ending log.\n\r");
 		logEnd();
 	}
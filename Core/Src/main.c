@@ -28,6 +28,8 @@
 #include "eeprom.h"
 #include "adc_spi.h"
 #include "log.h"
+#include "queue.h"
+#include "timebase.h"
 #include "stdbool.h"
 
 /* USER CODE END Includes */
@@ -52,6 +54,8 @@ ADC_HandleTypeDef hadc1;
 CAN_HandleTypeDef hcan1;
 
 SPI_HandleTypeDef hspi1;
+DMA_HandleTypeDef hdma_spi1_rx;
+DMA_HandleTypeDef hdma_spi1_tx;
 
 TIM_HandleTypeDef htim1;
 TIM_HandleTypeDef htim16;
@@ -61,7 +65,7 @@ DMA_HandleTypeDef hdma_usart2_rx;
 
 /* USER CODE BEGIN PV */
 uint8_t ADCnewData = 0;
-uint8_t runLogRoutine = 0;
+uint32_t frameSequence = 0;
 uint32_t timestamp;
 uint32_t nextLog = 0;
 
@@ -130,6 +134,7 @@ int main(void)
 	HAL_TIM_PWM_Start(&htim16, TIM_CHANNEL_1);
 	initPowerModule();
 	EEPROM_SPI_INIT();
+	timebaseInit();
 
 	if (ADCinit(&hspi1) != HAL_OK) {
 		printf("Error initializing ADC.\n\r");
@@ -149,13 +154,15 @@ int main(void)
     /* USER CODE BEGIN 3 */
 		houseKeep();
 
+#if !ADC_CAPTURE_DMA
 		if (ADCnewData >= 1){
-			ADCrawChannels();
-			runLogRoutine = 1;
 			ADCnewData = 0;
+			sampleQueuePush(frameSequence, timestamp, ADCframeGainTag(), ADCrawChannels());
 		}
+#endif
 
-		dataLogRoutine(timestamp, &runLogRoutine);
+		//frames captured by DMA from the DRDY interrupt are queued with their own timestamp
+		dataLogRoutine();
 
 		if(UARTdataAvailable){
 			if (UARTrxData[0] == '$'){
@@ -558,6 +565,12 @@ static void MX_DMA_Init(void)
   __HAL_RCC_DMA1_CLK_ENABLE();
 
   /* DMA interrupt init */
+  /* DMA1_Channel2_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel2_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel2_IRQn);
+  /* DMA1_Channel3_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel3_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel3_IRQn);
   /* DMA1_Channel6_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DMA1_Channel6_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
@@ -619,11 +632,24 @@ static void MX_GPIO_Init(void)
 /* USER CODE BEGIN 4 */
 void HAL_GPIO_EXTI_Callback(uint16_t interruptPin){
 	if (interruptPin == ADC_DRDY_Pin){
-		timestamp = HAL_GetTick();
+#if ADC_CAPTURE_DMA
+		ADCcaptureFrame(timebaseMicros());
+#else
+		timestamp = timebaseMicros();
+		frameSequence = ADCnextSequence();
 		ADCnewData++;
+#endif
 	}
 }
 
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi){
+	ADCcaptureComplete(hspi);
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi){
+	ADCcaptureError(hspi);
+}
+
 void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size){
 	if (huart == &huart2){
 		UARTdataAvailable = true;
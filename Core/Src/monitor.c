@@ -11,3 +11,447 @@
   */
 
 #include "monitor.h"
+#include "adc.h"
+#include <string.h>
+
+monitorConfigTypedef monitorConfig = { MONITOR_DEFAULT_WINDOW_MS, MONITOR_DEFAULT_DURATION_MS, MONITOR_DEFAULT_POWER, MONITOR_DEFAULT_VOLTAGE };
+monitorStatsTypedef monitorStats = {0};
+uint32_t monitorRate = 0;				//input samples per second
+
+int64_t monitorPowerRing[MONITOR_BUCKETS];		//power sum of every bucket, 2^MONITOR_POWER_SHIFT pW
+int64_t monitorVoltageRing[MONITOR_BUCKETS];	//voltage sum of every bucket, uV
+int64_t monitorPowerSum = 0;			//sums of the buckets in the window
+int64_t monitorVoltageSum = 0;
+int64_t monitorBucketPower = 0;			//sums of the bucket being filled
+int64_t monitorBucketVoltage = 0;
+int64_t monitorBucketCurrent = 0;
+uint32_t monitorBucketCount = 0;		//samples in the bucket being filled
+uint32_t monitorBucketSamples = 1;		//samples per bucket
+uint16_t monitorHead = 0;				//ring position of the bucket being filled
+uint16_t monitorWindowBuckets = 1;
+uint16_t monitorFilled = 0;				//buckets in the window, up to monitorWindowBuckets
+uint32_t monitorDurationBuckets = 1;	//buckets above a limit that make a violation
+uint32_t monitorOverBuckets = 0;		//consecutive buckets above a limit
+int64_t monitorPowerLimit;				//per sample limits, in the units of the sums
+int64_t monitorVoltageLimit;
+int64_t monitorPeak = 0;				//highest window average power, in the units of the sums
+
+float monitorLambda = MONITOR_RLS_LAMBDA;
+float monitorTheta[2];					//open-circuit voltage (V) and minus the resistance (ohm)
+float monitorCovariance[3];				//P00, P01 and P11 of the symmetric covariance
+monitorEstimateTypedef monitorEstimate = {0};
+uint32_t monitorEstimateBuckets = 0;	//buckets since the last logged estimate
+bool monitorEstimatePending = false;
+
+monitorEnergyTypedef monitorEnergy = {0};
+uint32_t monitorLastTimestamp = 0;		//timestamp of the previous integrated sample
+bool monitorTimestampValid = false;
+monitorEnergyRecordTypedef monitorEnergyRecord;
+
+//buckets needed to cover a time at the present rate, at least one
+static uint32_t monitorBuckets(uint32_t ms){
+	uint32_t buckets = (uint32_t)(((uint64_t)ms * monitorRate + 1000ULL * monitorBucketSamples - 1) / (1000ULL * monitorBucketSamples));
+
+	return buckets > 0 ? buckets : 1;
+}
+
+//time covered by a number of buckets, in ms
+static uint32_t monitorBucketsToMs(uint32_t buckets){
+	return monitorRate > 0 ? (uint32_t)((uint64_t)buckets * monitorBucketSamples * 1000 / monitorRate) : 0;
+}
+
+//power sum units to mW
+static int32_t monitorToMilliwatts(int64_t power){
+	return (int32_t)((power << MONITOR_POWER_SHIFT) / 1000000000LL);
+}
+
+/* Function      : monitorApply
+ *
+ * Description   : Sizes the buckets and the window for the configuration and
+ *               the input rate and empties the window. The statistics are
+ *               kept.
+ *
+ * Parameters    : None
+ *
+ * Returns       : None
+ */
+static void monitorApply(void){
+
+	uint32_t buckets;
+
+	monitorBucketSamples = monitorRate * MONITOR_BUCKET_MS / 1000;
+	monitorBucketSamples = monitorBucketSamples > 0 ? monitorBucketSamples : 1;
+
+	buckets = monitorBuckets(monitorConfig.windowMs);
+	monitorWindowBuckets = buckets > MONITOR_BUCKETS ? MONITOR_BUCKETS : buckets;
+	monitorDurationBuckets = monitorBuckets(monitorConfig.durationMs);
+
+	monitorPowerLimit = ((int64_t)monitorConfig.powerLimit * 1000000 * 1000000) >> MONITOR_POWER_SHIFT;
+	monitorVoltageLimit = (int64_t)monitorConfig.voltageLimit * 1000000;
+
+	for (uint16_t i = 0; i < MONITOR_BUCKETS; i++){
+		monitorPowerRing[i] = 0;
+		monitorVoltageRing[i] = 0;
+	}
+	monitorPowerSum = 0;
+	monitorVoltageSum = 0;
+	monitorBucketPower = 0;
+	monitorBucketVoltage = 0;
+	monitorBucketCurrent = 0;
+	monitorBucketCount = 0;
+	monitorHead = 0;
+	monitorFilled = 0;
+	monitorOverBuckets = 0;
+	monitorStats.active = false;
+}
+
+/* Function      : monitorConfigure
+ *
+ * Description   : Sets the window, the minimum violation duration and the
+ *               limits. The window is emptied, a violation in progress is
+ *               dropped.
+ *
+ * Parameters    : config new configuration
+ *
+ * Returns       : HAL_ERROR if the window does not fit MONITOR_BUCKETS or a
+ *               limit is out of range, HAL_OK otherwise
+ */
+uint8_t monitorConfigure(const monitorConfigTypedef *config){
+
+	if (config->windowMs < MONITOR_BUCKET_MS || config->windowMs > MONITOR_BUCKETS * MONITOR_BUCKET_MS ||
+			config->powerLimit == 0 || config->powerLimit > MONITOR_POWER_MAX || config->voltageLimit == 0 || config->voltageLimit > INT32_MAX / 1000000){
+		return HAL_ERROR;
+	}
+
+	monitorConfig = *config;
+	monitorApply();
+
+	printf("[monitor.c]Window %lu ms (%u buckets of %lu samples), %lu ms above %lu W or %lu V.\n\r", monitorConfig.windowMs,
+			monitorWindowBuckets, monitorBucketSamples, monitorConfig.durationMs, monitorConfig.powerLimit, monitorConfig.voltageLimit);
+
+	return HAL_OK;
+}
+
+const monitorConfigTypedef *monitorGetConfig(void){
+	return &monitorConfig;
+}
+
+//follows the ADC data rate, the window is emptied
+void monitorSetRate(uint32_t dataRate){
+	monitorRate = dataRate;
+	monitorApply();
+}
+
+uint32_t monitorGetRate(void){
+	return monitorRate;
+}
+
+/* Function      : monitorEstimateUpdate
+ *
+ * Description   : Recursive least squares update of the pack model
+ *               V = OCV + theta1 * I, theta1 being minus the resistance, with
+ *               the regressor [1, I]. The covariance is only divided by the
+ *               forgetting factor while its trace is below
+ *               MONITOR_RLS_TRACE_MAX.
+ *
+ * Parameters    : voltage bucket mean of the HV voltage, V
+ *               current bucket mean of the HV current, A
+ *
+ * Returns       : None
+ */
+static void monitorEstimateUpdate(float voltage, float current){
+
+	float p0, p1, den, k0, k1, error;
+	float forget;
+
+	if (monitorEstimate.updates == 0){
+		monitorTheta[0] = voltage;
+		monitorTheta[1] = 0.0f;
+		monitorCovariance[0] = MONITOR_RLS_P0;
+		monitorCovariance[1] = 0.0f;
+		monitorCovariance[2] = MONITOR_RLS_P0;
+	}
+
+	//P * phi, gain and prediction error
+	p0 = monitorCovariance[0] + monitorCovariance[1] * current;
+	p1 = monitorCovariance[1] + monitorCovariance[2] * current;
+	den = monitorLambda + p0 + p1 * current;
+	k0 = p0 / den;
+	k1 = p1 / den;
+	error = voltage - monitorTheta[0] - monitorTheta[1] * current;
+
+	monitorTheta[0] += k0 * error;
+	monitorTheta[1] += k1 * error;
+
+	forget = (monitorCovariance[0] + monitorCovariance[2] < MONITOR_RLS_TRACE_MAX) ? 1.0f / monitorLambda : 1.0f;
+	monitorCovariance[0] = (monitorCovariance[0] - k0 * p0) * forget;
+	monitorCovariance[1] = (monitorCovariance[1] - k0 * p1) * forget;
+	monitorCovariance[2] = (monitorCovariance[2] - k1 * p1) * forget;
+
+	monitorEstimate.ocv = monitorTheta[0];
+	monitorEstimate.resistance = -monitorTheta[1];
+	monitorEstimate.updates++;
+
+	if (++monitorEstimateBuckets >= monitorBuckets(MONITOR_RLS_LOG_MS)){
+		monitorEstimateBuckets = 0;
+		monitorEstimatePending = (monitorEstimate.updates >= MONITOR_RLS_MIN_UPDATES);
+	}
+}
+
+/* Function      : monitorProcess
+ *
+ * Description   : Adds a sample to the moving averages. Each time a bucket is
+ *               completed it enters the window, the oldest one leaves it and
+ *               the averages are compared with the limits.
+ *
+ * Parameters    : voltage HV voltage, uV
+ *               current HV current, uA
+ *
+ * Returns       : MONITOR_VIOLATION_START once the averages stayed above a limit
+ *               for the minimum duration, MONITOR_VIOLATION_END once they are
+ *               back below, MONITOR_NO_EVENT otherwise
+ */
+monitorEvent monitorProcess(int32_t voltage, int32_t current){
+
+	uint16_t oldest;
+	int64_t samples;
+	bool over;
+
+	monitorBucketPower += ((int64_t)voltage * current) >> MONITOR_POWER_SHIFT;
+	monitorBucketVoltage += voltage;
+	monitorBucketCurrent += current;
+
+	if (++monitorBucketCount < monitorBucketSamples){
+		return MONITOR_NO_EVENT;
+	}
+
+	monitorEstimateUpdate((float)(monitorBucketVoltage / monitorBucketSamples) / ADC_FIXED_SCALE,
+			(float)(monitorBucketCurrent / monitorBucketSamples) / ADC_FIXED_SCALE);
+
+	//the completed bucket replaces the one leaving the window
+	oldest = (monitorHead - monitorWindowBuckets) & (MONITOR_BUCKETS - 1);
+	monitorPowerSum += monitorBucketPower - monitorPowerRing[oldest];
+	monitorVoltageSum += monitorBucketVoltage - monitorVoltageRing[oldest];
+	monitorPowerRing[monitorHead] = monitorBucketPower;
+	monitorVoltageRing[monitorHead] = monitorBucketVoltage;
+	monitorHead = (monitorHead + 1) & (MONITOR_BUCKETS - 1);
+	monitorFilled += (monitorFilled < monitorWindowBuckets);
+
+	monitorBucketPower = 0;
+	monitorBucketVoltage = 0;
+	monitorBucketCurrent = 0;
+	monitorBucketCount = 0;
+
+	//averages compared as sums, no division
+	samples = (int64_t)monitorFilled * monitorBucketSamples;
+	over = (monitorPowerSum > monitorPowerLimit * samples) || (monitorVoltageSum > monitorVoltageLimit * samples);
+
+	if (monitorPowerSum > monitorPeak * samples){
+		monitorPeak = monitorPowerSum / samples;
+		monitorStats.peakPower = monitorToMilliwatts(monitorPeak);
+	}
+
+	if (over){
+		monitorOverBuckets++;
+
+		if (!monitorStats.active && monitorOverBuckets >= monitorDurationBuckets){
+			monitorStats.active = true;
+			monitorStats.violations++;
+			return MONITOR_VIOLATION_START;
+		}
+		return MONITOR_NO_EVENT;
+	}
+
+	if (monitorStats.active){
+		monitorStats.active = false;
+		monitorStats.lastDuration = monitorBucketsToMs(monitorOverBuckets);
+		monitorStats.total += monitorStats.lastDuration;
+		if (monitorStats.lastDuration > monitorStats.longest){
+			monitorStats.longest = monitorStats.lastDuration;
+		}
+		monitorOverBuckets = 0;
+		return MONITOR_VIOLATION_END;
+	}
+
+	monitorOverBuckets = 0;
+
+	return MONITOR_NO_EVENT;
+}
+
+//window average of the HV power, mW
+int32_t monitorAveragePower(void){
+	int64_t samples = (int64_t)monitorFilled * monitorBucketSamples;
+
+	return samples > 0 ? monitorToMilliwatts(monitorPowerSum / samples) : 0;
+}
+
+//window average of the HV voltage, uV
+int32_t monitorAverageVoltage(void){
+	int64_t samples = (int64_t)monitorFilled * monitorBucketSamples;
+
+	return samples > 0 ? (int32_t)(monitorVoltageSum / samples) : 0;
+}
+
+const monitorStatsTypedef *monitorGetStats(void){
+	return &monitorStats;
+}
+
+const monitorEstimateTypedef *monitorGetEstimate(void){
+	return &monitorEstimate;
+}
+
+//true once per MONITOR_RLS_LOG_MS when the estimate has settled, cleared by the call
+bool monitorEstimateDue(void){
+	bool due = monitorEstimatePending;
+
+	monitorEstimatePending = false;
+
+	return due;
+}
+
+//sets the forgetting factor of the pack estimator, which starts over
+uint8_t monitorSetForgetting(float lambda){
+
+	if (!(lambda >= MONITOR_RLS_LAMBDA_MIN && lambda <= 1.0f)){
+		return HAL_ERROR;
+	}
+
+	monitorLambda = lambda;
+	monitorEstimate = (monitorEstimateTypedef){0};
+	monitorEstimateBuckets = 0;
+	monitorEstimatePending = false;
+
+	return HAL_OK;
+}
+
+float monitorGetForgetting(void){
+	return monitorLambda;
+}
+
+//starts the totals of a new session
+void monitorEnergyReset(void){
+	monitorEnergy = (monitorEnergyTypedef){0};
+	monitorTimestampValid = false;
+}
+
+/* Function      : monitorIntegrate
+ *
+ * Description   : Integrates the power and the current of a sample over the
+ *               time elapsed since the previous one, taken from the sample
+ *               timestamps. Positive and negative (regen) values go to their
+ *               own totals without branches.
+ *
+ * Parameters    : voltage HV voltage, uV
+ *               current HV current, uA
+ *               timestamp sample timestamp, us
+ *
+ * Returns       : None
+ */
+void monitorIntegrate(int32_t voltage, int32_t current, uint32_t timestamp){
+
+	uint32_t dt = timestamp - monitorLastTimestamp;
+	int64_t energy, charge;
+	int64_t regen;
+
+	dt = monitorTimestampValid ? (dt < MONITOR_MAX_DT_US ? dt : MONITOR_MAX_DT_US) : 0;
+	monitorLastTimestamp = timestamp;
+	monitorTimestampValid = true;
+
+	energy = ((((int64_t)voltage * current) >> MONITOR_POWER_SHIFT) * dt) >> (MONITOR_ENERGY_SHIFT - MONITOR_POWER_SHIFT);
+	charge = (int64_t)current * dt;
+
+	//all ones for a negative value, zero otherwise
+	regen = energy >> 63;
+	monitorEnergy.dischargeEnergy += energy & ~regen;
+	monitorEnergy.regenEnergy -= energy & regen;
+
+	regen = charge >> 63;
+	monitorEnergy.dischargeCharge += charge & ~regen;
+	monitorEnergy.regenCharge -= charge & regen;
+
+	monitorEnergy.duration += dt;
+}
+
+const monitorEnergyTypedef *monitorGetEnergy(void){
+	return &monitorEnergy;
+}
+
+/* Function      : monitorSaveEnergy
+ *
+ * Description   : Stores the totals of the session in the parameters area of
+ *               the EEPROM identification page, next to the log index.
+ *
+ * Parameters    : logId log the totals belong to
+ *
+ * Returns       : HAL_OK or HAL_ERROR
+ */
+uint8_t monitorSaveEnergy(uint32_t logId){
+
+	monitorEnergyRecord.signature = MONITOR_ENERGY_SIGNATURE;
+	monitorEnergyRecord.logId = logId;
+	monitorEnergyRecord.totals = monitorEnergy;
+
+	if (EEPROMwriteParameters((uint8_t *)&monitorEnergyRecord, EEPROM_PARAM_ENERGY, sizeof(monitorEnergyRecord)) != EEPROM_STATUS_COMPLETE){
+		printf("[monitor.c]Error storing the energy totals.\n\r");
+		return HAL_ERROR;
+	}
+
+	printf("[monitor.c]Log %lu: %.3f Wh out, %.3f Wh regen, %.3f Ah out, %.3f Ah regen.\n\r", logId,
+			MONITOR_ENERGY_WH(monitorEnergy.dischargeEnergy), MONITOR_ENERGY_WH(monitorEnergy.regenEnergy),
+			MONITOR_CHARGE_AH(monitorEnergy.dischargeCharge), MONITOR_CHARGE_AH(monitorEnergy.regenCharge));
+
+	return HAL_OK;
+}
+
+//totals of the last log from the RAM copy of the identification page, NULL if none was stored
+const monitorEnergyRecordTypedef *monitorLoadEnergy(void){
+
+	memcpy(&monitorEnergyRecord, EEPROMextraInfo() + EEPROM_PARAM_ENERGY, sizeof(monitorEnergyRecord));
+
+	return monitorEnergyRecord.signature == MONITOR_ENERGY_SIGNATURE ? &monitorEnergyRecord : NULL;
+}
+
+/* Function      : monitorSave
+ *
+ * Description   : Copies the violation statistics and the pack estimator, so
+ *               a run of the monitor on test samples can be undone.
+ *
+ * Parameters    : snapshot returns the state
+ *
+ * Returns       : None
+ */
+void monitorSave(monitorSnapshotTypedef *snapshot){
+
+	snapshot->stats = monitorStats;
+	snapshot->peak = monitorPeak;
+	snapshot->lambda = monitorLambda;
+	memcpy(snapshot->theta, monitorTheta, sizeof(monitorTheta));
+	memcpy(snapshot->covariance, monitorCovariance, sizeof(monitorCovariance));
+	snapshot->estimate = monitorEstimate;
+	snapshot->estimateBuckets = monitorEstimateBuckets;
+	snapshot->estimatePending = monitorEstimatePending;
+}
+
+/* Function      : monitorRestore
+ *
+ * Description   : Puts back the state copied by monitorSave. The window is not
+ *               part of it, a violation in progress is dropped as when the
+ *               window is emptied.
+ *
+ * Parameters    : snapshot state to restore
+ *
+ * Returns       : None
+ */
+void monitorRestore(const monitorSnapshotTypedef *snapshot){
+
+	monitorStats = snapshot->stats;
+	monitorStats.active = false;
+	monitorOverBuckets = 0;
+	monitorPeak = snapshot->peak;
+	monitorLambda = snapshot->lambda;
+	memcpy(monitorTheta, snapshot->theta, sizeof(monitorTheta));
+	memcpy(monitorCovariance, snapshot->covariance, sizeof(monitorCovariance));
+	monitorEstimate = snapshot->estimate;
+	monitorEstimateBuckets = snapshot->estimateBuckets;
+	monitorEstimatePending = snapshot->estimatePending;
+}
@@ -16,8 +16,14 @@
 #include "stdbool.h"
 #include "main.h"
 #include "log.h"
+#include "timebase.h"
+
+extern bool UARTdataAvailable;
 
 static bool waitingToTurnOff;
+static bool standbyEnabled;
+static uint32_t idleSince;			//HAL tick of the last moment a log was running
+static uint32_t wakeCount;
 
 /************************** Primitives **************************/
 
@@ -75,6 +81,9 @@ void initPowerModule (void)
 {
 	setMcuPwrEn();
 	waitingToTurnOff = false;
+	standbyEnabled = true;
+	idleSince = HAL_GetTick();
+	wakeCount = 0;
 }
 
 /* Function      : initPowerModule
@@ -112,3 +121,97 @@ bool isWaitingToTurnOff (void)
 	return waitingToTurnOff;
 }
 
+/* Function      : getWakeThreshold
+ *
+ * Description   : Computes the current detect threshold. The ADC compares one
+ *               code magnitude on every enabled channel, the smaller of the
+ *               HV current wake threshold and the HV voltage log start
+ *               threshold is taken so either of them wakes the system.
+ *
+ * Parameters    : None
+ *
+ * Returns		 : threshold code magnitude
+ */
+static uint32_t getWakeThreshold (void)
+{
+	int32_t current = abs(ADCcodeFromFixed(HV_CURRENT_CH, POWER_WAKE_CURRENT_FIXED));
+	int32_t voltage = abs(ADCcodeFromFixed(HV_VOLTAGE_CH, LOG_HV_VOLTAGE_THRSH_FIXED));
+
+	return (uint32_t)(current < voltage ? current : voltage);
+}
+
+/* Function      : enterStandby
+ *
+ * Description   : Puts the ADC in current detect mode and the core to sleep
+ *               until a DRDY, UART data or the power enable going low. The
+ *               ADC keeps its CLKIN from TIM16, which only runs in Sleep mode.
+ *               The SysTick keeps running so the microsecond timebase stays
+ *               in step with the time slept.
+ *
+ * Parameters    : None
+ *
+ * Returns		 : None
+ */
+static void enterStandby (void)
+{
+	uint32_t sequence;
+
+	if (ADCenterStandby(getWakeThreshold()) != HAL_OK) {
+		idleSince = HAL_GetTick();
+		return;
+	}
+
+	printf("[power.c]Standby.\n\r");
+
+	sequence = ADCsequenceCount();
+	timebaseSleepEnter();
+
+	while (ADCsequenceCount() == sequence && !UARTdataAvailable && getPowerEnState() == GPIO_PIN_SET) {
+		HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
+	}
+
+	timebaseSleepExit();
+	ADCexitStandby();
+
+	wakeCount++;
+	idleSince = HAL_GetTick();
+
+	printf("[power.c]Wake up (%s).\n\r", ADCsequenceCount() != sequence ? "ADC threshold" : "UART or power");
+}
+
+/* Function      : checkStandby
+ *
+ * Description   : Enters the standby once no log has been running for
+ *               POWER_STANDBY_DELAY_MS.
+ *
+ * Parameters    : None
+ *
+ * Returns		 : None
+ */
+void checkStandby (void)
+{
+	if (!standbyEnabled || isLoggingOn() || waitingToTurnOff) {
+		idleSince = HAL_GetTick();
+		return;
+	}
+
+	if (HAL_GetTick() - idleSince >= POWER_STANDBY_DELAY_MS) {
+		enterStandby();
+	}
+}
+
+void setStandbyEnabled (bool enabled)
+{
+	standbyEnabled = enabled;
+	idleSince = HAL_GetTick();
+}
+
+bool isStandbyEnabled (void)
+{
+	return standbyEnabled;
+}
+
+uint32_t getWakeCount (void)
+{
+	return wakeCount;
+}
@@ -0,0 +1,195 @@
+/*******************************************************************************
+  * File Name			: queue.c
+  * Description			: This module implements a single producer / single
+  * 					  consumer queue of (sequence, timestamp, raw frame)
+  * 					  samples.
+  * 					  The producer is the ADC acquisition interrupt chain
+  * 					  and the consumer is the logging loop. Each side only
+  * 					  writes its own index, so no critical section is
+  * 					  needed.
+  *
+  * Date				: October 17, 2026
+  ******************************************************************************
+  */
+
+#include "queue.h"
+#include <string.h>
+
+sampleTypedef sampleQueue[SAMPLE_QUEUE_SIZE];
+volatile uint32_t sampleQueueHead = 0;		//written by the producer only
+volatile uint32_t sampleQueueTail = 0;		//written by the consumer only
+volatile uint32_t sampleQueueHighWater = 0;
+volatile uint32_t sampleQueueOverruns = 0;
+
+/* Function      : sampleQueueProducerSlot
+ *
+ * Description   : Returns the slot the producer shall fill next. The slot is
+ *               only visible to the consumer after sampleQueueCommit.
+ *
+ * Parameters    : None
+ *
+ * Returns       : pointer to the free slot, NULL if the queue is full. In that
+ *               case the sample is counted as an overrun.
+ */
+sampleTypedef *sampleQueueProducerSlot(void)
+{
+	uint32_t head = sampleQueueHead;
+
+	if ((head - sampleQueueTail) >= SAMPLE_QUEUE_SIZE) {
+		sampleQueueOverruns++;
+		return NULL;
+	}
+
+	return &sampleQueue[head & SAMPLE_QUEUE_MASK];
+}
+
+/* Function      : sampleQueueCommit
+ *
+ * Description   : Publishes the slot returned by sampleQueueProducerSlot.
+ *
+ * Parameters    : None
+ *
+ * Returns       : None
+ */
+void sampleQueueCommit(void)
+{
+	uint32_t head = sampleQueueHead + 1;
+	uint32_t level = head - sampleQueueTail;
+
+	//the slot content must be written before the consumer can see it
+	__DMB();
+	sampleQueueHead = head;
+
+	if (level > sampleQueueHighWater) {
+		sampleQueueHighWater = level;
+	}
+}
+
+/* Function      : sampleQueuePush
+ *
+ * Description   : Copies a frame into the queue. Used when frames are read in
+ *               blocking mode.
+ *
+ * Parameters    : sequence frame sequence number
+ *               timestamp sample timestamp
+ *               gainTag PGA settings the frame was converted with
+ *               frame raw ADC frame, ADC_FRAME_SIZE bytes
+ *
+ * Returns       : None
+ */
+void sampleQueuePush(uint32_t sequence, uint32_t timestamp, uint16_t gainTag, uint8_t *frame)
+{
+	sampleTypedef *slot = sampleQueueProducerSlot();
+
+	if (slot == NULL || frame == NULL) {
+		return;
+	}
+
+	slot->sequence = sequence;
+	slot->timestamp = timestamp;
+	slot->gainTag = gainTag;
+	slot->response = false;
+	memcpy(slot->frame, frame, ADC_FRAME_SIZE);
+	sampleQueueCommit();
+}
+
+/* Function      : sampleQueuePeek
+ *
+ * Description   : Returns the oldest sample without removing it.
+ *
+ * Parameters    : None
+ *
+ * Returns       : pointer to the sample, NULL if the queue is empty.
+ */
+sampleTypedef *sampleQueuePeek(void)
+{
+	uint32_t tail = sampleQueueTail;
+
+	if (tail == sampleQueueHead) {
+		return NULL;
+	}
+
+	//the slot must not be read before the head that published it
+	__DMB();
+
+	return &sampleQueue[tail & SAMPLE_QUEUE_MASK];
+}
+
+/* Function      : sampleQueueRelease
+ *
+ * Description   : Removes the sample returned by sampleQueuePeek, giving the
+ *               slot back to the producer.
+ *
+ * Parameters    : None
+ *
+ * Returns       : None
+ */
+void sampleQueueRelease(void)
+{
+	//reading the slot must complete before the producer can reuse it
+	__DMB();
+	sampleQueueTail = sampleQueueTail + 1;
+}
+
+/* Function      : sampleQueuePeekBatch
+ *
+ * Description   : Returns the oldest samples that are contiguous in memory, so
+ *               they can be processed as an array. A batch stops at the end
+ *               of the queue storage, the rest is returned by the next call.
+ *
+ * Parameters    : count returns the number of samples in the batch
+ *
+ * Returns       : pointer to the first sample, NULL if the queue is empty.
+ */
+sampleTypedef *sampleQueuePeekBatch(uint16_t *count)
+{
+	uint32_t tail = sampleQueueTail;
+	uint32_t level = sampleQueueHead - tail;
+	uint32_t toEnd = SAMPLE_QUEUE_SIZE - (tail & SAMPLE_QUEUE_MASK);
+
+	*count = level < toEnd ? level : toEnd;
+
+	if (level == 0) {
+		return NULL;
+	}
+
+	//the slots must not be read before the head that published them
+	__DMB();
+
+	return &sampleQueue[tail & SAMPLE_QUEUE_MASK];
+}
+
+//removes the first count samples returned by sampleQueuePeekBatch
+void sampleQueueReleaseBatch(uint16_t count)
+{
+	__DMB();
+	sampleQueueTail = sampleQueueTail + count;
+}
+
+uint32_t sampleQueueCount(void)
+{
+	return sampleQueueHead - sampleQueueTail;
+}
+
+/* Function      : sampleQueueReset
+ *
+ * Description   : Empties the queue and clears the statistics. Shall only be
+ *               called while the producer is stopped.
+ *
+ * Parameters    : None
+ *
+ * Returns       : None
+ */
+void sampleQueueReset(void)
+{
+	sampleQueueTail = sampleQueueHead;
+	sampleQueueHighWater = 0;
+	sampleQueueOverruns = 0;
+}
+
+void sampleQueueGetStats(sampleQueueStatsTypedef *stats)
+{
+	stats->count = sampleQueueCount();
+	stats->highWater = sampleQueueHighWater;
+	stats->overruns = sampleQueueOverruns;
+}
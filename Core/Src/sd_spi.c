@@ -17,14 +17,27 @@ uint16_t Timer1, Timer2;					/* 1ms Timer Counter */
 static volatile DSTATUS Stat = STA_NOINIT;	/* Disk Status */
 static uint8_t CardType;                    /* Type 0:MMC, 1:SDC, 2:Block addressing */
 static uint8_t PowerFlag = 0;				/* Power flag */
+static bool Selected = false;				/* SD owns the shared SPI bus */
 
 /***************************************
  * SPI functions
  **************************************/
 
-/* slave select */
+/* takes the shared SPI bus in the SD mode. The mode is only set once the bus is
+ * owned, the release of a previous lock can start an ADC transfer in its mode */
+static void SD_BusLock(void)
+{
+	spiBusLock();
+	checkAndConfigureSpiMode(HSPI_SDCARD, SD_CPOL, SD_CPHA);		//Check the SPI configuration before doing any Tx or Rx
+}
+
+/* slave select, the shared SPI bus is owned until deselect */
 static void SELECT(void)
 {
+	if (!Selected) {
+		SD_BusLock();
+		Selected = true;
+	}
 	HAL_GPIO_WritePin(SD_CS_GPIO_Port, SD_CS_Pin, GPIO_PIN_RESET);
 	HAL_Delay(1);
 }
@@ -34,20 +47,28 @@ static void DESELECT(void)
 {
 	HAL_GPIO_WritePin(SD_CS_GPIO_Port, SD_CS_Pin, GPIO_PIN_SET);
 	HAL_Delay(1);
+	if (Selected) {
+		Selected = false;
+		spiBusUnlock();
+	}
 }
 
 /* SPI transmit a byte */
 static void SPI_TxByte(uint8_t data)
 {
+	SD_BusLock();
 	while(!__HAL_SPI_GET_FLAG(HSPI_SDCARD, SPI_FLAG_TXE));
 	HAL_SPI_Transmit(HSPI_SDCARD, &data, 1, SPI_TIMEOUT);
+	spiBusUnlock();
 }
 
 /* SPI transmit buffer */
 static void SPI_TxBuffer(uint8_t *buffer, uint16_t len)
 {
+	SD_BusLock();
 	while(!__HAL_SPI_GET_FLAG(HSPI_SDCARD, SPI_FLAG_TXE));
 	HAL_SPI_Transmit(HSPI_SDCARD, buffer, len, SPI_TIMEOUT);
+	spiBusUnlock();
 }
 
 /* SPI receive a byte */
@@ -56,8 +77,10 @@ static uint8_t SPI_RxByte(void)
 	uint8_t dummy, data;
 	dummy = 0xFF;
 
+	SD_BusLock();
 	while(!__HAL_SPI_GET_FLAG(HSPI_SDCARD, SPI_FLAG_TXE));
 	HAL_SPI_TransmitReceive(HSPI_SDCARD, &dummy, &data, 1, SPI_TIMEOUT);
+	spiBusUnlock();
 
 	return data;
 }
@@ -100,8 +123,6 @@ static void SD_PowerOn(void)
 		SPI_TxByte(0xFF);
 	}
 
-	checkAndConfigureSpiMode(HSPI_SDCARD, SD_CPOL, SD_CPHA);		//Check the SPI configuration before doing any Tx or Rx
-
 	/* slave select */
 	SELECT();
 
@@ -260,8 +281,6 @@ DSTATUS SD_disk_initialize(BYTE drv)
 	/* power on */
 	SD_PowerOn();
 
-	checkAndConfigureSpiMode(HSPI_SDCARD, SD_CPOL, SD_CPHA);		//Check the SPI configuration before doing any Tx or Rx
-
 	/* slave select */
 	SELECT();
 
@@ -352,8 +371,6 @@ DRESULT SD_disk_read(BYTE pdrv, BYTE* buff, DWORD sector, UINT count)
 	/* convert to byte address */
 	if (!(CardType & CT_SD2)) sector *= 512;
 
-	checkAndConfigureSpiMode(HSPI_SDCARD, SD_CPOL, SD_CPHA);		//Check the SPI configuration before doing any Tx or Rx
-
 	SELECT();
 
 	if (count == 1) {
@@ -395,8 +412,6 @@ DRESULT SD_disk_write(BYTE pdrv, const BYTE* buff, DWORD sector, UINT count)
 	/* convert to byte address */
 	if (!(CardType & CT_SD2)) sector *= 512;
 
-	checkAndConfigureSpiMode(HSPI_SDCARD, SD_CPOL, SD_CPHA);		//Check the SPI configuration before doing any Tx or Rx
-
 	SELECT();
 
 	if (count == 1) {
@@ -463,8 +478,6 @@ DRESULT SD_disk_ioctl(BYTE drv, BYTE ctrl, void *buff)
 		/* no disk */
 		if (Stat & STA_NOINIT) return RES_NOTRDY;
 
-		checkAndConfigureSpiMode(HSPI_SDCARD, SD_CPOL, SD_CPHA);		//Check the SPI configuration before doing any Tx or Rx
-
 		SELECT();
 
 		switch (ctrl) {
@@ -13,6 +13,13 @@
 #include "spi.h"
 #include "integrity.h"
 
+//the SPI1 bus is shared by the ADC, the EEPROM and the SD card. The ADC frames
+//are read by DMA from interrupt context, so every chip select window opened
+//from the main loop must own the bus.
+static volatile uint8_t spiBusDepth = 0;		//nested locks held by the main loop
+static volatile bool spiBusIsrOwned = false;	//bus owned by an interrupt driven transfer
+static void (*spiBusReleaseHook)(void) = NULL;
+
 
 /* Function      : spiWrite
  *
@@ -122,8 +129,134 @@ static bool isSpiModeConfigured(SPI_HandleTypeDef* handler, uint8_t cpol, uint8_
  * Returns         : None
  */
 void checkAndConfigureSpiMode(SPI_HandleTypeDef* handler, uint8_t cpol, uint8_t cpha)
+{
+	spiBusLock();
+
+	if(!isSpiModeConfigured(handler,cpol,cpha)) {
+		modifySpiMode(handler,cpol,cpha);
+	}
+
+	spiBusUnlock();
+}
+
+/* Function      : checkAndConfigureSpiModeFromISR
+ *
+ * Description   : Same as checkAndConfigureSpiMode, to be called from interrupt
+ *               context by the owner of a spiBusTryLockFromISR lock.
+ *
+ * Parameters    :  handler pointer to a SPI_HandleTypeDef structure that contains
+ *               the configuration information for SPI module.error code.
+ *               cpol clock polarity.
+ *               cpha clock phase.
+ *
+ * Returns         : None
+ */
+void checkAndConfigureSpiModeFromISR(SPI_HandleTypeDef* handler, uint8_t cpol, uint8_t cpha)
 {
 	if(!isSpiModeConfigured(handler,cpol,cpha)) {
 		modifySpiMode(handler,cpol,cpha);
 	}
 }
+
+/* Function      : spiBusLock
+ *
+ * Description   : Takes the shared SPI bus from the main loop. Waits for any
+ *               interrupt driven transfer to finish. Calls can be nested.
+ *
+ * Parameters    : None
+ *
+ * Returns         : None
+ */
+void spiBusLock(void)
+{
+	uint32_t primask;
+
+	while (1) {
+		primask = __get_PRIMASK();
+		__disable_irq();
+
+		if (!spiBusIsrOwned) {
+			spiBusDepth++;
+			__set_PRIMASK(primask);
+			return;
+		}
+
+		__set_PRIMASK(primask);
+	}
+}
+
+/* Function      : spiBusUnlock
+ *
+ * Description   : Releases one level of the main loop bus lock. When the bus
+ *               becomes free the release hook is called so transfers that
+ *               were deferred by an interrupt can be started.
+ *
+ * Parameters    : None
+ *
+ * Returns         : None
+ */
+void spiBusUnlock(void)
+{
+	if (spiBusDepth == 0) {
+		return;
+	}
+
+	spiBusDepth--;
+
+	if (spiBusDepth == 0 && spiBusReleaseHook != NULL) {
+		spiBusReleaseHook();
+	}
+}
+
+/* Function      : spiBusTryLockFromISR
+ *
+ * Description   : Tries to take the shared SPI bus from interrupt context.
+ *
+ * Parameters    : None
+ *
+ * Returns         : True if the bus was free and is now owned by the caller.
+ */
+bool spiBusTryLockFromISR(void)
+{
+	uint32_t primask;
+	bool locked = false;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (spiBusDepth == 0 && !spiBusIsrOwned) {
+		spiBusIsrOwned = true;
+		locked = true;
+	}
+
+	__set_PRIMASK(primask);
+
+	return locked;
+}
+
+/* Function      : spiBusUnlockFromISR
+ *
+ * Description   : Releases the bus taken with spiBusTryLockFromISR.
+ *
+ * Parameters    : None
+ *
+ * Returns         : None
+ */
+void spiBusUnlockFromISR(void)
+{
+	spiBusIsrOwned = false;
+}
+
+/* Function      : spiSetBusReleaseHook
+ *
+ * Description   : Registers the function called when the main loop releases
+ *               the bus.
+ *
+ * Parameters    : hook function to be called, NULL to remove it.
+ *
+ * Returns         : None
+ */
+void spiSetBusReleaseHook(void (*hook)(void))
+{
+	spiBusReleaseHook = hook;
+}
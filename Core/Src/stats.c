@@ -0,0 +1,352 @@
+/*******************************************************************************
+  * File Name			: stats.c
+  * Description			: This module implements the windowed statistics (min,
+  * 					  max, mean and RMS) of the measured channels and of the
+  * 					  HV power, updated with every acquired sample.
+  *
+  * Date				: October 17, 2026
+  ******************************************************************************
+  */
+
+#include "stats.h"
+#include "adc.h"
+#include <string.h>
+
+//running sums of a window over its ring of buckets, the extrema come from monotonic deques
+//of ring slots: the front of minQueue is the slot of the smallest bucket minimum
+typedef struct {
+	statsAggregateTypedef ring[STATS_SERIES][STATS_BUCKETS];
+	uint32_t	samples[STATS_BUCKETS];		//samples of every bucket
+	int64_t		sum[STATS_SERIES];
+	double		sumSquares[STATS_SERIES];
+	uint32_t	count;						//samples in the window
+	uint8_t		minQueue[STATS_SERIES][STATS_BUCKETS];
+	uint8_t		maxQueue[STATS_SERIES][STATS_BUCKETS];
+	uint8_t		minFront[STATS_SERIES];
+	uint8_t		minLength[STATS_SERIES];
+	uint8_t		maxFront[STATS_SERIES];
+	uint8_t		maxLength[STATS_SERIES];
+	uint8_t		slot;						//ring slot of the next bucket
+	uint8_t		filled;						//buckets in the window, up to STATS_BUCKETS
+	statsAggregateTypedef bucket[STATS_SERIES];	//bucket being filled from the shorter window
+	uint32_t	bucketSamples;
+	uint8_t		children;					//buckets of the shorter window merged in bucket
+} statsWindowTypedef;
+
+statsWindowTypedef statsWindows[STATS_WINDOWS];
+statsAggregateTypedef statsSession[STATS_SERIES] = {
+	{ INT32_MAX, INT32_MIN, 0, 0 }, { INT32_MAX, INT32_MIN, 0, 0 }, { INT32_MAX, INT32_MIN, 0, 0 }, { INT32_MAX, INT32_MIN, 0, 0 }
+};
+uint32_t statsSessionCount = 0;
+uint32_t statsRate = 0;
+uint32_t statsBaseSamples = 1;			//samples per bucket of the shortest window
+
+//bucket of the shortest window, filled sample by sample with integer sums
+int32_t statsMin[STATS_SERIES];
+int32_t statsMax[STATS_SERIES];
+int64_t statsSum[STATS_SERIES];
+uint64_t statsSquares[STATS_SERIES];
+uint32_t statsCount = 0;
+
+uint32_t statsHistograms[STATS_HIST_QTY][STATS_HIST_BINS];	//samples of the session in every bin
+
+const statsHistogramInfoTypedef statsHistogramInfo[STATS_HIST_QTY] = {
+	[STATS_HIST_POWER] = { "power", STATS_HIST_POWER_SHIFT, STATS_HIST_POWER_OFFSET, (double)(1ULL << STATS_POWER_SHIFT) / 1e12 },
+	[STATS_HIST_CURRENT] = { "current", STATS_HIST_CURRENT_SHIFT, STATS_HIST_CURRENT_OFFSET, 1.0 / ADC_FIXED_SCALE },
+	[STATS_HIST_VOLTAGE] = { "voltage", STATS_HIST_VOLTAGE_SHIFT, STATS_HIST_VOLTAGE_OFFSET, 1.0 / ADC_FIXED_SCALE },
+};
+
+//histogram bin of a value, the offset keeps the subtraction of the range start out of int32 overflow
+#define STATS_HIST_BIN(value, shift, offset)	__USAT(((value) >> (shift)) + (offset), 5)
+
+//ring position of the k-th element of a deque
+#define STATS_QUEUE_AT(front, k)	(((front) + (k)) % STATS_BUCKETS)
+
+static void statsClear(statsAggregateTypedef *aggregate){
+	aggregate->min = INT32_MAX;
+	aggregate->max = INT32_MIN;
+	aggregate->sum = 0;
+	aggregate->sumSquares = 0;
+}
+
+static void statsMerge(statsAggregateTypedef *to, const statsAggregateTypedef *from){
+	to->min = from->min < to->min ? from->min : to->min;
+	to->max = from->max > to->max ? from->max : to->max;
+	to->sum += from->sum;
+	to->sumSquares += from->sumSquares;
+}
+
+static void statsClearBucket(void){
+	for (uint8_t s = 0; s < STATS_SERIES; s++){
+		statsMin[s] = INT32_MAX;
+		statsMax[s] = INT32_MIN;
+		statsSum[s] = 0;
+		statsSquares[s] = 0;
+	}
+	statsCount = 0;
+}
+
+//integer square root, the query path only
+static uint32_t statsSqrt(uint64_t value){
+	uint64_t root = 0;
+	uint64_t bit = 1ULL << 62;
+
+	while (bit > value){
+		bit >>= 2;
+	}
+	while (bit != 0){
+		if (value >= root + bit){
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return (uint32_t)root;
+}
+
+/* Function      : statsPush
+ *
+ * Description   : Adds a completed bucket to a window. The bucket leaving the
+ *               window is subtracted from the sums and dropped from the front
+ *               of the deques, the new one enters the back of the deques after
+ *               the buckets it dominates. Every completed bucket is also merged
+ *               into the bucket being filled for the next longer window.
+ *
+ * Parameters    : id window id
+ *               bucket completed bucket of every series
+ *               samples samples in the bucket
+ *
+ * Returns       : None
+ */
+static void statsPush(uint8_t id, const statsAggregateTypedef *bucket, uint32_t samples){
+
+	statsWindowTypedef *window = &statsWindows[id];
+	uint8_t slot = window->slot;
+	bool full = (window->filled == STATS_BUCKETS);
+
+	if (full){
+		window->count -= window->samples[slot];
+	}
+	window->samples[slot] = samples;
+	window->count += samples;
+
+	for (uint8_t s = 0; s < STATS_SERIES; s++){
+		if (full){
+			window->sum[s] -= window->ring[s][slot].sum;
+			window->sumSquares[s] -= window->ring[s][slot].sumSquares;
+
+			//the slot reused is the oldest bucket, at most at the front
+			if (window->minLength[s] > 0 && window->minQueue[s][window->minFront[s]] == slot){
+				window->minFront[s] = STATS_QUEUE_AT(window->minFront[s], 1);
+				window->minLength[s]--;
+			}
+			if (window->maxLength[s] > 0 && window->maxQueue[s][window->maxFront[s]] == slot){
+				window->maxFront[s] = STATS_QUEUE_AT(window->maxFront[s], 1);
+				window->maxLength[s]--;
+			}
+		}
+
+		window->ring[s][slot] = bucket[s];
+		window->sum[s] += bucket[s].sum;
+		window->sumSquares[s] += bucket[s].sumSquares;
+
+		while (window->minLength[s] > 0 &&
+				window->ring[s][window->minQueue[s][STATS_QUEUE_AT(window->minFront[s], window->minLength[s] - 1)]].min >= bucket[s].min){
+			window->minLength[s]--;
+		}
+		window->minQueue[s][STATS_QUEUE_AT(window->minFront[s], window->minLength[s])] = slot;
+		window->minLength[s]++;
+
+		while (window->maxLength[s] > 0 &&
+				window->ring[s][window->maxQueue[s][STATS_QUEUE_AT(window->maxFront[s], window->maxLength[s] - 1)]].max <= bucket[s].max){
+			window->maxLength[s]--;
+		}
+		window->maxQueue[s][STATS_QUEUE_AT(window->maxFront[s], window->maxLength[s])] = slot;
+		window->maxLength[s]++;
+	}
+
+	window->slot = (slot + 1) % STATS_BUCKETS;
+	window->filled += !full;
+
+	if (id + 1 >= STATS_WINDOWS){
+		return;
+	}
+
+	//cascade into the bucket of the next window
+	window = &statsWindows[id + 1];
+	for (uint8_t s = 0; s < STATS_SERIES; s++){
+		statsMerge(&window->bucket[s], &bucket[s]);
+	}
+	window->bucketSamples += samples;
+
+	if (++window->children >= STATS_BUCKETS){
+		statsPush(id + 1, window->bucket, window->bucketSamples);
+		for (uint8_t s = 0; s < STATS_SERIES; s++){
+			statsClear(&window->bucket[s]);
+		}
+		window->bucketSamples = 0;
+		window->children = 0;
+	}
+}
+
+//follows the ADC data rate, the windows are emptied and the session is kept
+void statsSetRate(uint32_t dataRate){
+
+	statsRate = dataRate;
+	statsBaseSamples = dataRate * STATS_BUCKET_MS / 1000;
+	statsBaseSamples = statsBaseSamples > 0 ? statsBaseSamples : 1;
+
+	for (uint8_t id = 0; id < STATS_WINDOWS; id++){
+		memset(&statsWindows[id], 0, sizeof(statsWindows[id]));
+		for (uint8_t s = 0; s < STATS_SERIES; s++){
+			statsClear(&statsWindows[id].bucket[s]);
+		}
+	}
+	statsClearBucket();
+}
+
+uint32_t statsGetRate(void){
+	return statsRate;
+}
+
+//starts the session statistics and histograms
+void statsReset(void){
+	for (uint8_t s = 0; s < STATS_SERIES; s++){
+		statsClear(&statsSession[s]);
+	}
+	statsSessionCount = 0;
+	memset(statsHistograms, 0, sizeof(statsHistograms));
+}
+
+/* Function      : statsProcess
+ *
+ * Description   : Adds a sample of the three channels and of the HV power to
+ *               the session histograms and to the bucket of the shortest
+ *               window. A full bucket is pushed into the windows and merged
+ *               into the session.
+ *
+ * Parameters    : channels converted channels, micro-units
+ *
+ * Returns       : None
+ */
+void statsProcess(const int32_t *channels){
+
+	statsAggregateTypedef bucket[STATS_SERIES];
+	int32_t values[STATS_SERIES] = { channels[0], channels[1], channels[2],
+			(int32_t)(((int64_t)channels[HV_VOLTAGE_CH] * channels[HV_CURRENT_CH]) >> STATS_POWER_SHIFT) };
+	int32_t value, square;
+
+	statsHistograms[STATS_HIST_POWER][STATS_HIST_BIN(values[STATS_POWER], STATS_HIST_POWER_SHIFT, STATS_HIST_POWER_OFFSET)]++;
+	statsHistograms[STATS_HIST_CURRENT][STATS_HIST_BIN(values[HV_CURRENT_CH], STATS_HIST_CURRENT_SHIFT, STATS_HIST_CURRENT_OFFSET)]++;
+	statsHistograms[STATS_HIST_VOLTAGE][STATS_HIST_BIN(values[HV_VOLTAGE_CH], STATS_HIST_VOLTAGE_SHIFT, STATS_HIST_VOLTAGE_OFFSET)]++;
+
+	for (uint8_t s = 0; s < STATS_SERIES; s++){
+		value = values[s];
+		square = value >> STATS_SQUARE_SHIFT;
+
+		statsMin[s] = value < statsMin[s] ? value : statsMin[s];
+		statsMax[s] = value > statsMax[s] ? value : statsMax[s];
+		statsSum[s] += value;
+		statsSquares[s] += (int64_t)square * square;
+	}
+
+	if (++statsCount < statsBaseSamples){
+		return;
+	}
+
+	for (uint8_t s = 0; s < STATS_SERIES; s++){
+		bucket[s].min = statsMin[s];
+		bucket[s].max = statsMax[s];
+		bucket[s].sum = statsSum[s];
+		bucket[s].sumSquares = (double)statsSquares[s];
+		statsMerge(&statsSession[s], &bucket[s]);
+	}
+	statsSessionCount += statsCount;
+
+	statsPush(0, bucket, statsCount);
+	statsClearBucket();
+}
+
+/* Function      : statsGet
+ *
+ * Description   : Gives the statistics of every series over a window, the
+ *               buckets completed so far while the window fills up.
+ *
+ * Parameters    : window window id, STATS_SESSION for the session
+ *               result STATS_SERIES results, zero when there are no samples
+ *
+ * Returns       : samples the statistics cover
+ */
+uint32_t statsGet(uint8_t window, statsResultTypedef *result){
+
+	const statsWindowTypedef *stats = &statsWindows[window < STATS_WINDOWS ? window : 0];
+	uint32_t count = (window >= STATS_WINDOWS) ? statsSessionCount : stats->count;
+	int64_t sum;
+	double sumSquares;
+	uint64_t rms;
+
+	for (uint8_t s = 0; s < STATS_SERIES; s++){
+		if (count == 0){
+			result[s] = (statsResultTypedef){0};
+			continue;
+		}
+
+		if (window >= STATS_WINDOWS){
+			result[s].min = statsSession[s].min;
+			result[s].max = statsSession[s].max;
+			sum = statsSession[s].sum;
+			sumSquares = statsSession[s].sumSquares;
+		} else {
+			result[s].min = stats->ring[s][stats->minQueue[s][stats->minFront[s]]].min;
+			result[s].max = stats->ring[s][stats->maxQueue[s][stats->maxFront[s]]].max;
+			sum = stats->sum[s];
+			sumSquares = stats->sumSquares[s];
+		}
+
+		sumSquares = sumSquares > 0 ? sumSquares : 0;
+		result[s].mean = (int32_t)(sum / count);
+		rms = (uint64_t)statsSqrt((uint64_t)(sumSquares / count)) << STATS_SQUARE_SHIFT;
+		result[s].rms = rms < INT32_MAX ? (int32_t)rms : INT32_MAX;
+	}
+
+	return count;
+}
+
+//time covered by a full window, or by the session so far, in ms
+uint32_t statsWindowMs(uint8_t window){
+
+	uint32_t samples = statsSessionCount;
+
+	if (window < STATS_WINDOWS){
+		samples = statsBaseSamples * STATS_BUCKETS;
+		for (uint8_t id = 0; id < window; id++){
+			samples *= STATS_BUCKETS;
+		}
+	}
+
+	return statsRate > 0 ? (uint32_t)((uint64_t)samples * 1000 / statsRate) : 0;
+}
+
+const uint32_t *statsGetHistogram(uint8_t histogram){
+	return statsHistograms[histogram < STATS_HIST_QTY ? histogram : 0];
+}
+
+const statsHistogramInfoTypedef *statsGetHistogramInfo(uint8_t histogram){
+	return &statsHistogramInfo[histogram < STATS_HIST_QTY ? histogram : 0];
+}
+
+//copies the session statistics and histograms, so a run on test samples can be undone
+void statsSave(statsSnapshotTypedef *snapshot){
+	memcpy(snapshot->session, statsSession, sizeof(statsSession));
+	snapshot->sessionCount = statsSessionCount;
+	memcpy(snapshot->histograms, statsHistograms, sizeof(statsHistograms));
+}
+
+void statsRestore(const statsSnapshotTypedef *snapshot){
+	memcpy(statsSession, snapshot->session, sizeof(statsSession));
+	statsSessionCount = snapshot->sessionCount;
+	memcpy(statsHistograms, snapshot->histograms, sizeof(statsHistograms));
+}
@@ -0,0 +1,143 @@
+/*******************************************************************************
+  * File Name			: timebase.c
+  * Description			: This module implements the microsecond timebase used
+  * 					  to timestamp the ADC samples. The DWT cycle counter is
+  * 					  extended to 64 bits in software and converted to
+  * 					  microseconds, so it shall be read at least once per
+  * 					  counter wrap (2^32 core cycles, 134 s at 32 MHz).
+  *
+  * Date				: October 17, 2026
+  ******************************************************************************
+  */
+
+#include "timebase.h"
+
+uint32_t timebaseLastCycles = 0;		//counter value of the last update
+uint32_t timebaseRemainder = 0;			//cycles not yet accounted as a whole microsecond
+uint32_t timebaseCyclesPerMicro = 1;
+uint64_t timebaseMicrosCount = 0;
+
+//the cycle counter stops while the core sleeps, the time is then kept up with the SysTick
+bool timebaseSleeping = false;
+uint64_t timebaseSleepTick = 0;			//SysTick time at the sleep entry, us
+uint64_t timebaseSleepMicros = 0;		//timebase at the sleep entry
+
+/* Function      : timebaseInit
+ *
+ * Description   : Enables the DWT cycle counter and starts the timebase at 0.
+ *
+ * Parameters    : None
+ *
+ * Returns       : None
+ */
+void timebaseInit(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	timebaseCyclesPerMicro = SystemCoreClock / 1000000;
+	timebaseLastCycles = DWT->CYCCNT;
+	timebaseRemainder = 0;
+	timebaseMicrosCount = 0;
+}
+
+/* Function      : timebaseTickMicros
+ *
+ * Description   : Time of the HAL SysTick in microseconds, the tick count plus
+ *               the part of the current tick elapsed. Called with the
+ *               interrupts disabled.
+ *
+ * Parameters    : None
+ *
+ * Returns       : microseconds counted by the SysTick
+ */
+static uint64_t timebaseTickMicros(void)
+{
+	uint32_t load = SysTick->LOAD + 1;
+	uint32_t val = SysTick->VAL;
+	uint64_t ticks = HAL_GetTick();
+
+	//the tick wrapped but its interrupt was not served yet
+	if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+		val = SysTick->VAL;
+		ticks++;
+	}
+
+	return ticks * HAL_GetTickFreq() * 1000 + (load - val) / timebaseCyclesPerMicro;
+}
+
+/* Function      : timebaseMicros64
+ *
+ * Description   : Updates the timebase with the cycles elapsed since the last
+ *               call. Safe to call from interrupts and from the main loop.
+ *
+ * Parameters    : None
+ *
+ * Returns       : microseconds since timebaseInit
+ */
+uint64_t timebaseMicros64(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	uint32_t cycles;
+	uint64_t micros, elapsed;
+
+	__disable_irq();
+
+	cycles = DWT->CYCCNT;
+	timebaseRemainder += cycles - timebaseLastCycles;
+	timebaseLastCycles = cycles;
+
+	timebaseMicrosCount += timebaseRemainder / timebaseCyclesPerMicro;
+	timebaseRemainder = timebaseRemainder % timebaseCyclesPerMicro;
+
+	//adds the time slept, which the cycle counter missed
+	if (timebaseSleeping) {
+		elapsed = timebaseTickMicros() - timebaseSleepTick;
+		if (elapsed > timebaseMicrosCount - timebaseSleepMicros) {
+			timebaseMicrosCount = timebaseSleepMicros + elapsed;
+		}
+	}
+	micros = timebaseMicrosCount;
+
+	__set_PRIMASK(primask);
+
+	return micros;
+}
+
+//low 32 bits of the timebase, differences are valid across the 71 minute wrap
+uint32_t timebaseMicros(void)
+{
+	return (uint32_t)timebaseMicros64();
+}
+
+/* Function      : timebaseSleepEnter
+ *
+ * Description   : Called before the core is put to sleep with the SysTick
+ *               running. Until timebaseSleepExit the timebase follows the
+ *               SysTick whenever it falls behind, also for the timestamps
+ *               taken by the interrupts that end the sleep.
+ *
+ * Parameters    : None
+ *
+ * Returns       : None
+ */
+void timebaseSleepEnter(void)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+
+	timebaseSleeping = false;
+	timebaseSleepMicros = timebaseMicros64();
+	timebaseSleepTick = timebaseTickMicros();
+	timebaseSleeping = true;
+
+	__set_PRIMASK(primask);
+}
+
+//brings the timebase up to date after the sleep and returns to the cycle counter alone
+void timebaseSleepExit(void)
+{
+	timebaseMicros64();
+	timebaseSleeping = false;
+}
@@ -23,6 +23,42 @@ userInterfaceMenuTypedef shuntValueMenu;
 userInterfaceMenuTypedef voltageDividerMenu;
 userInterfaceMenuTypedef aboutMenu;
 
+/* Function      : uiGetArgument
+ *
+ * Description   : copies one of the '/' separated command arguments that
+ *               follow the command code, stopping at the first char that is
+ *               not alphanumeric, '-' or '.'
+ *
+ * Parameters    :  rxData pointer to array with the UART data
+ *               index argument position, 0 is the first one
+ *               arg destination buffer
+ *               size destination buffer size
+ *
+ * Returns       : length of the argument, 0 if there is none
+ */
+static uint8_t uiGetArgument(uint8_t *rxData, uint8_t index, char *arg, uint8_t size){
+	uint8_t len = 0;
+	uint8_t pos = 9;
+
+	while (rxData[pos] == '/'){
+		pos++;
+		if (index == 0){
+			while (len < size - 1 && (isalnum(rxData[pos + len]) || rxData[pos + len] == '-' || rxData[pos + len] == '.')){
+				arg[len] = rxData[pos + len];
+				len++;
+			}
+			break;
+		}
+		while (isalnum(rxData[pos]) || rxData[pos] == '-' || rxData[pos] == '.'){
+			pos++;
+		}
+		index--;
+	}
+	arg[len] = '\0';
+
+	return len;
+}
+
 /* Function      : uiCommand
  *
  * Description   : executes the command required by GUI
@@ -34,6 +70,24 @@ userInterfaceMenuTypedef aboutMenu;
 
 void uiCommand(uint8_t *rxData){
 	eepromStatisticsTypeDef eepromStat;
+	const ADCcalibrationTypedef *cal;
+	const ADChealthTypedef *health;
+	const monitorStatsTypedef *monitorStat;
+	monitorConfigTypedef monitorConfig;
+	const monitorEnergyTypedef *energy;
+	const monitorEnergyRecordTypedef *energyRecord;
+	statsResultTypedef stats[STATS_SERIES];
+	const char *windows[STATS_WINDOWS + 1] = { "100ms", "1s", "10s", "session" };
+	uint32_t samples;
+	const monitorEstimateTypedef *estimate;
+	const statsHistogramInfoTypedef *histogramInfo;
+	const uint32_t *histogram;
+	logStatsTypedef logStat;
+	sampleQueueStatsTypedef queueStat;
+	char arg[16];
+	char ref[16];
+	int8_t id;
+	int32_t delay;
 	if (!memcmp(rxData, "$239C5zAI", 9)){
 		getEEPROMstatistics(&eepromStat);
 		printf("$239C5zAI/%lu/%.1f/%.2f\r\n", eepromStat.logQty, eepromStat.memoryOccupied, eepromStat.memoryRemaining);
@@ -48,13 +102,236 @@ void uiCommand(uint8_t *rxData){
 		printf("$239C5zAI/%lu/%.1f/%.2f\r\n", eepromStat.logQty, eepromStat.memoryOccupied, eepromStat.memoryRemaining);
 
 	} else if (!memcmp(rxData, "$AIQvPX5u", 9)){
-		printf("WIP: Read Parameters\r\n");
+		//calibration of each channel: offset in codes, gain with 0x800000 as 1.0
+		cal = ADCgetCalibration();
+		printf("$AIQvPX5u/%ld/%lu/%ld/%lu/%ld/%lu\r\n", cal->offset[0], cal->gain[0],
+				cal->offset[1], cal->gain[1], cal->offset[2], cal->gain[2]);
 
 	} else if (!memcmp(rxData, "$S5lKne26", 9)){
-		printf("WIP: Write Parameters\r\n");
+		printf("$S5lKne26/%s\r\n", ADCsaveCalibration() == HAL_OK ? "OK" : "ERROR");
 
 	} else if (!memcmp(rxData, "$F6hMHnV1", 9)){
-		printf("WIP: Reset Parameters\r\n");
+		if (ADCresetCalibration() != HAL_OK || ADCsaveCalibration() != HAL_OK){
+			printf("$F6hMHnV1/ERROR\r\n");
+		} else {
+			printf("$F6hMHnV1/OK\r\n");
+		}
+
+	} else if (!memcmp(rxData, "$Ar8gPn2L", 9)){
+		//auto-ranging PGA: "$Ar8gPn2L/on" or "$Ar8gPn2L/off", replies the state and the gain of each channel
+		if (uiGetArgument(rxData, 0, arg, sizeof(arg)) > 0){
+			ADCautoRangeEnable(!strcmp(arg, "on"));
+		}
+		printf("$Ar8gPn2L/%s/%u/%u/%u\r\n", ADCautoRangeEnabled() ? "on" : "off", 1 << ADC_GAIN_TAG_GAIN(ADCgetGainTag(), 0),
+				1 << ADC_GAIN_TAG_GAIN(ADCgetGainTag(), 1), 1 << ADC_GAIN_TAG_GAIN(ADCgetGainTag(), 2));
+
+	} else if (!memcmp(rxData, "$Fl7rDc3S", 9)){
+		//low speed log rate: "$Fl7rDc3S/<SPS>" sets the filter output rate, replies the rate and decimation
+		if (uiGetArgument(rxData, 0, arg, sizeof(arg)) > 0){
+			if (atoi(arg) <= 0 || isLoggingOn()){
+				printf("$Fl7rDc3S/ERROR\r\n");
+				return;
+			}
+			filterConfigure(ADCgetProfileInfo(ADCgetProfile())->dataRate, atoi(arg));
+		}
+		printf("$Fl7rDc3S/%u/%lu\r\n", filterGetOutputRate(), filterGetDecimation());
+
+	} else if (!memcmp(rxData, "$Rg4mCk9V", 9)){
+		//ADC configuration check against the register cache
+		printf("$Rg4mCk9V/%s\r\n", ADCcheckRegisters() == HAL_OK ? "OK" : "ERROR");
+
+	} else if (!memcmp(rxData, "$Cz3oFf8K", 9)){
+		//offset calibration: "$Cz3oFf8K/<channel>" with the channel input at zero
+		if (isLoggingOn() || uiGetArgument(rxData, 0, arg, sizeof(arg)) == 0 ||
+				ADCcalibrateOffset(atoi(arg)) != HAL_OK){
+			printf("$Cz3oFf8K/ERROR\r\n");
+			return;
+		}
+		printf("$Cz3oFf8K/%d/%ld\r\n", atoi(arg), ADCgetCalibration()->offset[atoi(arg)]);
+
+	} else if (!memcmp(rxData, "$Cg6rEf2T", 9)){
+		//gain calibration: "$Cg6rEf2T/<channel>/<reference>" with the reference in A or V applied
+		if (isLoggingOn() || uiGetArgument(rxData, 0, arg, sizeof(arg)) == 0 ||
+				uiGetArgument(rxData, 1, ref, sizeof(ref)) == 0 ||
+				ADCcalibrateGain(atoi(arg), (int32_t)(atof(ref) * ADC_FIXED_SCALE)) != HAL_OK){
+			printf("$Cg6rEf2T/ERROR\r\n");
+			return;
+		}
+		printf("$Cg6rEf2T/%d/%lu\r\n", atoi(arg), ADCgetCalibration()->gain[atoi(arg)]);
+
+	} else if (!memcmp(rxData, "$Sq6nLs3G", 9)){
+		//sample-loss counters: acquired/processed/lost/gaps/gap records/records logged/store errors/
+		//log backlog high water/queue high water/queue overruns/frames dropped/CRC errors/ADC resets/failed ADC resets
+		logGetStats(&logStat);
+		sampleQueueGetStats(&queueStat);
+		printf("$Sq6nLs3G/%lu/%lu/%lu/%lu/%lu/%lu/%lu/%lu/%lu/%lu/%lu/%lu/%lu/%lu\r\n", logStat.framesAcquired, logStat.framesProcessed,
+				logStat.framesLost, logStat.gaps, logStat.gapRecords, logStat.recordsLogged, logStat.storeErrors,
+				logStat.backlogHighWater, queueStat.highWater, queueStat.overruns, ADCframesDropped(), ADCcrcErrors(),
+				ADCgetOutage()->count, ADCgetOutage()->failures);
+
+	} else if (!memcmp(rxData, "$Ph2sAl5D", 9)){
+		//phase delays: "$Ph2sAl5D/<channel>/<modulator clocks>" sets one channel, replies the three delays
+		if (uiGetArgument(rxData, 0, arg, sizeof(arg)) > 0){
+			if (uiGetArgument(rxData, 1, ref, sizeof(ref)) == 0 || ADCsetPhase(atoi(arg), atoi(ref)) != HAL_OK){
+				printf("$Ph2sAl5D/ERROR\r\n");
+				return;
+			}
+		}
+		cal = ADCgetCalibration();
+		printf("$Ph2sAl5D/%d/%d/%d\r\n", cal->phase[0], cal->phase[1], cal->phase[2]);
+
+	} else if (!memcmp(rxData, "$Pm8tSt4E", 9)){
+		//phase measurement: apply a HV current step within ADC_PHASE_TIMEOUT, replies the
+		//voltage edge delay and the HV current and voltage phase delays set from it
+		if (isLoggingOn() || ADCmeasurePhase(&delay) != HAL_OK){
+			printf("$Pm8tSt4E/ERROR\r\n");
+			return;
+		}
+		cal = ADCgetCalibration();
+		printf("$Pm8tSt4E/%ld/%d/%d\r\n", delay, cal->phase[HV_CURRENT_CH], cal->phase[HV_VOLTAGE_CH]);
+
+	} else if (!memcmp(rxData, "$Lw5kFm2C", 9)){
+		//frame layout: "$Lw5kFm2C/<channel mask>/<word bits>" sets the enabled channels and the
+		//16, 24 or 32-bit (sign-extended) word length, replies the mask, the word length and the bytes per frame
+		if (uiGetArgument(rxData, 0, arg, sizeof(arg)) > 0){
+			if (isLoggingOn() || uiGetArgument(rxData, 1, ref, sizeof(ref)) == 0 ||
+					ADCsetLayout(strtol(arg, NULL, 0), atoi(ref)) != HAL_OK){
+				printf("$Lw5kFm2C/ERROR\r\n");
+				return;
+			}
+		}
+		printf("$Lw5kFm2C/%u/%u/%u\r\n", ADCgetLayout()->channelMask, ADCgetLayout()->wordBytes * 8, ADCgetLayout()->frameSize);
+
+	} else if (!memcmp(rxData, "$bQ7nCh4R", 9)){
+		//the benchmarks run on the live filter, monitor and statistics
+		if (isLoggingOn()){
+			printf("$bQ7nCh4R/ERROR\r\n");
+			return;
+		}
+		benchRun();
+
+	} else if (!memcmp(rxData, "$Rt5pF8wQ", 9)){
+		//data-rate profile: "$Rt5pF8wQ/<name>" switches, "$Rt5pF8wQ" reads the active one
+		if (uiGetArgument(rxData, 0, arg, sizeof(arg)) > 0){
+			id = ADCfindProfile(arg);
+			if (id < 0 || ADCsetProfile((ADCprofileId)id) != HAL_OK){
+				printf("$Rt5pF8wQ/ERROR\r\n");
+				return;
+			}
+		}
+		printf("$Rt5pF8wQ/%s/%lu\r\n", ADCgetProfileInfo(ADCgetProfile())->name, ADCgetProfileInfo(ADCgetProfile())->dataRate);
+
+	} else if (!memcmp(rxData, "$Hs3tAd8W", 9)){
+		//ADC health from the frame STATUS words: STATUS frames/response frames/resets/register map
+		//changes/input CRC errors/resyncs/channels without new data
+		health = ADCgetHealth();
+		printf("$Hs3tAd8W/%lu/%lu/%lu/%lu/%lu/%lu/%lu\r\n", health->statusFrames, health->responseFrames, health->resets,
+				health->regmapChanges, health->inputCrcErrors, health->resyncs, health->drdyMissing);
+
+	} else if (!memcmp(rxData, "$Sb4wKe7T", 9)){
+		//standby: "$Sb4wKe7T/<0|1>" disables or enables it, replies the state and the wake ups so far
+		if (uiGetArgument(rxData, 0, arg, sizeof(arg)) > 0){
+			setStandbyEnabled(atoi(arg) != 0);
+		}
+		printf("$Sb4wKe7T/%u/%lu\r\n", isStandbyEnabled(), getWakeCount());
+
+	} else if (!memcmp(rxData, "$Mc5wPl9V", 9)){
+		//compliance monitor: "$Mc5wPl9V/<window ms>/<duration ms>/<power W>/<voltage V>" sets it, replies the configuration
+		if (uiGetArgument(rxData, 0, arg, sizeof(arg)) > 0){
+			monitorConfig = *monitorGetConfig();
+			monitorConfig.windowMs = atol(arg);
+			if (uiGetArgument(rxData, 1, ref, sizeof(ref)) > 0){
+				monitorConfig.durationMs = atol(ref);
+			}
+			if (uiGetArgument(rxData, 2, ref, sizeof(ref)) > 0){
+				monitorConfig.powerLimit = atol(ref);
+			}
+			if (uiGetArgument(rxData, 3, ref, sizeof(ref)) > 0){
+				monitorConfig.voltageLimit = atol(ref);
+			}
+			if (monitorConfigure(&monitorConfig) != HAL_OK){
+				printf("$Mc5wPl9V/ERROR\r\n");
+				return;
+			}
+		}
+		printf("$Mc5wPl9V/%lu/%lu/%lu/%lu\r\n", monitorGetConfig()->windowMs, monitorGetConfig()->durationMs,
+				monitorGetConfig()->powerLimit, monitorGetConfig()->voltageLimit);
+
+	} else if (!memcmp(rxData, "$Mv2tSt6Q", 9)){
+		//compliance monitor state: violations/in violation/longest ms/total ms/peak average mW/average mW/average mV
+		monitorStat = monitorGetStats();
+		printf("$Mv2tSt6Q/%lu/%u/%lu/%lu/%ld/%ld/%ld\r\n", monitorStat->violations, monitorStat->active, monitorStat->longest,
+				monitorStat->total, monitorStat->peakPower, monitorAveragePower(), monitorAverageVoltage() / 1000);
+
+	} else if (!memcmp(rxData, "$En4gWh7A", 9)){
+		//energy: "$En4gWh7A" replies the running session totals, "$En4gWh7A/last" the ones stored with the
+		//last log: [log id/]discharge Wh/regen Wh/discharge Ah/regen Ah/integrated s
+		if (uiGetArgument(rxData, 0, arg, sizeof(arg)) > 0 && !strcmp(arg, "last")){
+			if ((energyRecord = monitorLoadEnergy()) == NULL){
+				printf("$En4gWh7A/ERROR\r\n");
+				return;
+			}
+			energy = &energyRecord->totals;
+			printf("$En4gWh7A/%lu/", energyRecord->logId);
+		} else {
+			energy = monitorGetEnergy();
+			printf("$En4gWh7A/");
+		}
+		printf("%.3f/%.3f/%.3f/%.3f/%.1f\r\n", MONITOR_ENERGY_WH(energy->dischargeEnergy), MONITOR_ENERGY_WH(energy->regenEnergy),
+				MONITOR_CHARGE_AH(energy->dischargeCharge), MONITOR_CHARGE_AH(energy->regenCharge), (double)energy->duration / 1000000);
+
+	} else if (!memcmp(rxData, "$St8wNd3X", 9)){
+		//windowed statistics: "$St8wNd3X/<100ms|1s|10s|session>", 1s by default. Replies the window label, its ms, the samples
+		//and min/max/mean/rms of the supply current (A), HV current (A), HV voltage (V) and HV power (W)
+		id = 1;
+		if (uiGetArgument(rxData, 0, arg, sizeof(arg)) > 0){
+			id = 0;
+			while (id <= STATS_WINDOWS && strcmp(arg, windows[id])){
+				id++;
+			}
+			if (id > STATS_WINDOWS){
+				printf("$St8wNd3X/ERROR\r\n");
+				return;
+			}
+		}
+		//the windows are labeled with their real length, which depends on the data rate
+		samples = statsGet(id, stats);
+		if (id < STATS_WINDOWS){
+			snprintf(arg, sizeof(arg), "%lums", statsWindowMs(id));
+		} else {
+			strcpy(arg, windows[id]);
+		}
+		printf("$St8wNd3X/%s/%lu/%lu", arg, statsWindowMs(id), samples);
+		for (uint8_t i = 0; i < STATS_POWER; i++){
+			printf("/%.4f/%.4f/%.4f/%.4f", ADC_FIXED_TO_DOUBLE(stats[i].min), ADC_FIXED_TO_DOUBLE(stats[i].max),
+					ADC_FIXED_TO_DOUBLE(stats[i].mean), ADC_FIXED_TO_DOUBLE(stats[i].rms));
+		}
+		printf("/%.1f/%.1f/%.1f/%.1f\r\n", STATS_POWER_TO_W(stats[STATS_POWER].min), STATS_POWER_TO_W(stats[STATS_POWER].max),
+				STATS_POWER_TO_W(stats[STATS_POWER].mean), STATS_POWER_TO_W(stats[STATS_POWER].rms));
+
+	} else if (!memcmp(rxData, "$Rp3kOc7E", 9)){
+		//pack estimate: "$Rp3kOc7E/<forgetting factor>" sets the factor and restarts the estimator,
+		//replies the open-circuit voltage (V), the resistance (mOhm), the updates and the factor
+		if (uiGetArgument(rxData, 0, arg, sizeof(arg)) > 0 && monitorSetForgetting(atof(arg)) != HAL_OK){
+			printf("$Rp3kOc7E/ERROR\r\n");
+			return;
+		}
+		estimate = monitorGetEstimate();
+		printf("$Rp3kOc7E/%.2f/%.2f/%lu/%.4f\r\n", estimate->ocv, estimate->resistance * 1000.0f, estimate->updates, monitorGetForgetting());
+
+	} else if (!memcmp(rxData, "$Hg5bIn2S", 9)){
+		//session histograms, one line each: name/start of the first bin/bin width (W, A or V)/samples of every bin
+		for (uint8_t h = 0; h < STATS_HIST_QTY; h++){
+			histogramInfo = statsGetHistogramInfo(h);
+			histogram = statsGetHistogram(h);
+
+			printf("$Hg5bIn2S/%s/%.1f/%.1f", histogramInfo->name, -(double)histogramInfo->offset * (double)(1UL << histogramInfo->shift) * histogramInfo->unit,
+					(double)(1UL << histogramInfo->shift) * histogramInfo->unit);
+			for (uint8_t bin = 0; bin < STATS_HIST_BINS; bin++){
+				printf("/%lu", histogram[bin]);
+			}
+			printf("\r\n");
+		}
 
 	}
 }